@@ -0,0 +1,2930 @@
+#include "libyategrep.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static bool isChannelParam(const TelEngine::String& name)
+{
+	using namespace TelEngine;
+	if(name == YSTRING("id"))
+		return true;
+	if(name == YSTRING("targetid"))
+		return true;
+	if(name == YSTRING("peerid"))
+		return true;
+	if(name == YSTRING("lastpeerid"))
+		return true;
+	if(name == YSTRING("newid"))
+		return true;
+	if(name == YSTRING("id.1"))
+		return true;
+	if(name == YSTRING("newid.1"))
+		return true;
+	if(name == YSTRING("peerid.1"))
+		return true;
+	return false;
+}
+
+static const TelEngine::Regexp reAddress("[\\.\\/:]"); // to seize addresses like "ring", "" etc
+
+static bool isAddressParam(const TelEngine::NamedString& s)
+{
+	using namespace TelEngine;
+	if(s.name() == YSTRING("address") && reAddress.matches(s))
+		return true;
+	return false;
+}
+
+
+/* Channel ids are only unique inside one Yate: when merging several nodes
+ * they are remembered as "node|id" */
+static inline TelEngine::String channelKey(const Entry& e, const TelEngine::String& chan)
+{
+	if(! e.node())
+		return chan;
+	TelEngine::String key(*e.node());
+	key << "|" << chan;
+	return key;
+}
+
+static inline bool sameChannel(const TelEngine::String& key, const Entry& e, const TelEngine::String& chan)
+{
+	if(! e.node())
+		return key == chan;
+	const TelEngine::String& node = *e.node();
+	return key.length() == node.length() + 1 + chan.length()
+		&& key.startsWith(node) && key.at(node.length()) == '|'
+		&& chan == key.c_str() + node.length() + 1;
+}
+
+static inline bool isKeyParam(const TelEngine::String& name)
+{
+	using namespace TelEngine;
+	return name == YSTRING("callid") || name == YSTRING("branch") || name == YSTRING("callref");
+}
+
+/* Call-IDs and branches are global, Q.931 call references only unique per link */
+static inline TelEngine::String callKey(const Entry& e, const TelEngine::NamedString& s)
+{
+	if(s.name() != YSTRING("callref"))
+		return s;
+	TelEngine::String key(e["address"]);
+	key << "/" << s;
+	return channelKey(e, key);
+}
+
+static bool fullMatch(const TelEngine::NamedList& key, const TelEngine::NamedList& entry)
+{
+	unsigned int n = entry.length();
+	unsigned int qn = key.length();
+#if 0
+TelEngine::String d1, d2;
+key.dump(d1, " ", '\'', true);
+entry.dump(d2, " ", '\'', true);
+fprintf(stderr, "Checkong entry %s against key %s\n", d2.c_str(), d1.c_str());
+#endif
+	for(unsigned int qi = 0; qi < qn; ++qi) {
+		TelEngine::NamedString* q = key.getParam(qi);
+		if(! q)
+			continue;
+		bool found = false;
+		for(unsigned int i = 0; i < n; ++i) {
+			TelEngine::NamedString* s = entry.getParam(i);
+			if(! s)
+				continue;
+			if(s->name() == q->name()) {
+				found = true;
+				if(*s != *q)
+					return false; /* AND logic, fail on first non-equal param */
+				else
+					break;
+			}
+		}
+		if(! found)
+			return false; /* all requested parameters should be here */
+	}
+	return true;
+}
+
+bool Query::matches(const Entry& e, bool partial /* = false */) const
+{
+	if(!partial) { /* Full match */
+		if(e.type() == Entry::MESSAGE && fullMatch(params(), e))
+			return true;
+	}
+
+	for(TelEngine::ObjList* chans = m_channels + (partial ? m_newChannels : 0); chans; chans = chans->skipNext()) { // check channel names
+		TelEngine::GenObject* o = chans->get();
+		if(! o)
+			continue;
+		const TelEngine::String& chan = o->toString();
+		unsigned int n = e.length();
+		for(unsigned int i = 0; i < n; ++i) {
+			TelEngine::NamedString* s = e.getParam(i);
+			if(! s)
+				continue;
+			if(! isChannelParam(s->name()))
+				continue;
+			if(sameChannel(chan, e, *s))
+				return true;
+		}
+	}
+	if(e.type() == Entry::MESSAGE) { // a leg on another node is first known by the Call-ID of its packets
+		const TelEngine::NamedString* callid = e.getParam(YSTRING("sip_callid"));
+		return callid && m_keys.find(*callid);
+	}
+	if(e.type() != Entry::NETWORK || m_noNetwork) // select by addresses only network messages or we will gel tons of selected junk
+		return false;
+	/* packets carrying a call key are selected by it or by naming the call's
+	 * numbers, address is only a fallback for peers not tied to a call yet,
+	 * and only forward: the buffer holds other calls' packets to the same peer */
+	bool keyed = false;
+	unsigned int n = e.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s || ! isKeyParam(s->name()))
+			continue;
+		keyed = true;
+		if(s->name() == YSTRING("callref") ? m_keys.find(callKey(e, *s)) : m_keys.find(*s))
+			return true;
+	}
+	if(keyed) {
+		const TelEngine::String& addr = e["address"];
+		TelEngine::String link = channelKey(e, addr);
+		if(m_bound.find(addr) || m_bound.find(link))
+			return false;
+		if(namesCall(e, partial)) // update() binds its path to its keys
+			return true;
+		if(partial)
+			return false;
+		/* Q.931 packet on a link of ours not tied to the call yet: shown, never binds */
+		if(m_links.find(link))
+			return true;
+	}
+	for(TelEngine::ObjList* addrs = m_addrs + (partial ? m_newAddrs : 0); addrs; addrs = addrs->skipNext()) { // check addresses
+		TelEngine::GenObject* o = addrs->get();
+		if(! o)
+			continue;
+		TelEngine::String addr = o->toString();
+		unsigned int n = e.length();
+		for(unsigned int i = 0; i < n; ++i) {
+			TelEngine::NamedString* s = e.getParam(i);
+			if(! s)
+				continue;
+			if(! isAddressParam(*s))
+				continue;
+			if(*s == addr)
+				return true;
+		}
+	}
+	return false;
+}
+
+/* User part of a SIP URI target (sip/sip:200@host), routing may have rewritten the called number */
+static TelEngine::String uriUser(const TelEngine::String& target)
+{
+	int at = target.find('@');
+	int start = target.find("sip:");
+	if(at < 0 || start < 0 || start > at)
+		return TelEngine::String();
+	start += 4;
+	return target.substr(start, at - start);
+}
+
+/* Updates query with new channels and addresses from log entry. @return true if query was really modified */
+bool Query::update(const Entry& e, bool reset, TelEngine::ObjList* added /* = NULL */)
+{
+	if(e.type() == Entry::NETWORK)
+		return updateNetwork(e, reset, added);
+	if(e.type() != Entry::MESSAGE) // Update only from messages
+		return false;
+	if(reset) {
+		m_newChannels = m_channels.count();
+		m_newAddrs = m_addrs.count();
+	}
+	bool modified = false;
+	unsigned int n = e.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s)
+			continue;
+		if(isChannelParam(s->name())) {
+			TelEngine::String key = channelKey(e, *s);
+			if(m_channels.find(key))
+				continue;
+			m_channels.append(new TelEngine::String(key), false);
+			if(added)
+				added->append(new TelEngine::String(key));
+			modified = true;
+		} else if(s->name() == YSTRING("called") || s->name() == YSTRING("caller") || s->name() == YSTRING("callto")) {
+			if(addNumber(s->name() == YSTRING("callto") ? uriUser(*s) : *s))
+				modified = true;
+		} else if(s->name() == YSTRING("sip_callid")) {
+			if(! addKey(*s, added))
+				continue;
+			const TelEngine::NamedString* addr = e.getParam(YSTRING("address"));
+			if(addr && isAddressParam(*addr) && ! m_bound.find(*addr))
+				m_bound.append(new TelEngine::String(*addr));
+			modified = true;
+		} else if(isAddressParam(*s)) {
+			if(m_addrs.find(*s))
+				continue;
+			m_addrs.append(new TelEngine::String(*s), false);
+			if(added)
+				added->append(new TelEngine::String(*s));
+			modified = true;
+		} else if(s->name() == YSTRING("address") && ! s->null()) { // a link name, not a transport address
+			TelEngine::String link = channelKey(e, *s);
+			if(! m_links.find(link))
+				m_links.append(new TelEngine::String(link));
+		}
+	}
+	return modified;
+}
+
+bool Query::addNumber(const TelEngine::String& num)
+{
+	if(num.length() < 3 || m_numbers.find(num))
+		return false;
+	m_numbers.append(new TelEngine::String(num));
+	return true;
+}
+
+bool Query::addKey(const TelEngine::String& key, TelEngine::ObjList* added)
+{
+	if(key.null() || m_keys.find(key))
+		return false;
+	m_keys.append(new TelEngine::String(key));
+	if(added)
+		added->append(new TelEngine::String(key));
+	return true;
+}
+
+/* A number as user part of a SIP URI or as a Q.931 number field */
+static bool namesNumber(const TelEngine::String& text, const TelEngine::String& num)
+{
+	for(int pos = text.find(num); pos >= 0; pos = text.find(num, pos + 1)) {
+		char next = text.at(pos + num.length());
+		int start = (text.at(pos - 1) == '+') ? pos - 1 : pos;
+		if(next == '@' && text.at(start - 1) == ':')
+			return true;
+		if((next < '0' || next > '9') && start >= 7 && ! ::strncmp(text.c_str() + start - 7, "number=", 7))
+			return true;
+	}
+	return false;
+}
+
+/* Packet on a path of ours naming one of the call's numbers. Looking back
+ * only Q.931 links count: a Setup precedes the channel's first message, while
+ * earlier packets to a SIP peer may be older calls to the same number */
+bool Query::namesCall(const Entry& e, bool partial /* = false */) const
+{
+	if(! m_numbers.skipNull())
+		return false;
+	const TelEngine::String& addr = e["address"];
+	if(! m_links.find(channelKey(e, addr)) && (partial || ! m_addrs.find(addr)))
+		return false;
+	for(TelEngine::ObjList* l = m_numbers.skipNull(); l; l = l->skipNext())
+		if(namesNumber(e.text(), l->get()->toString()))
+			return true;
+	return false;
+}
+
+/* Selected packet: if it belongs to the call, its call keys select the rest
+ * of its dialog and tie its peer to them */
+bool Query::updateNetwork(const Entry& e, bool reset, TelEngine::ObjList* added)
+{
+	if(reset) { // a new deep search only looks for what it learns
+		m_newChannels = m_channels.count();
+		m_newAddrs = m_addrs.count();
+	}
+	bool modified = false;
+	bool keyed = false;
+	bool known = false;
+	unsigned int n = e.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s || ! isKeyParam(s->name()))
+			continue;
+		keyed = true;
+		if(m_keys.find(callKey(e, *s)))
+			known = true;
+	}
+	/* selected only by its path: may be another call's, learn nothing from it */
+	if(keyed && ! known && ! namesCall(e))
+		keyed = false;
+	else if(keyed) {
+		for(unsigned int i = 0; i < n; ++i) {
+			TelEngine::NamedString* s = e.getParam(i);
+			if(s && isKeyParam(s->name()) && addKey(callKey(e, *s), added))
+				modified = true;
+		}
+	}
+	const TelEngine::String& addr = e["address"];
+	if(keyed && ! addr.null()) {
+		TelEngine::String bind = e.getParam(YSTRING("callref")) ? channelKey(e, addr) : addr; // links are per node
+		if(! m_bound.find(bind))
+			m_bound.append(new TelEngine::String(bind));
+	}
+	if(! e.node())
+		return modified;
+	/* packet to another merged node: follow the call there by our own address,
+	 * which is what that node logs as the remote end */
+	const TelEngine::String& local = e["local"];
+	if(local.null() || ! m_nodeAddrs.find(addr) || m_addrs.find(local))
+		return modified;
+	m_addrs.append(new TelEngine::String(local), false);
+	if(added)
+		added->append(new TelEngine::String(local));
+	return true;
+}
+
+bool Query::hasChannel(const TelEngine::NamedList& params)
+{
+	unsigned int n = params.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		const TelEngine::NamedString* s = params.getParam(i);
+		if(s && isChannelParam(s->name()))
+			return true;
+	}
+	return false;
+}
+
+void Query::learn(const Entry& e)
+{
+	if(e.type() != Entry::NETWORK || ! e.node())
+		return;
+	const TelEngine::String& local = e["local"];
+	if(local.null() || m_nodeAddrs.find(local))
+		return;
+	m_nodeAddrs.append(new TelEngine::String(local));
+}
+
+void Query::flush(const TelEngine::String& node)
+{
+	TelEngine::String prefix(node);
+	prefix << "|";
+	TelEngine::ObjList* l = m_channels.skipNull();
+	while(l) {
+		if(l->get()->toString().startsWith(prefix)) {
+			l->remove();
+			l = l->skipNull();
+		} else
+			l = l->skipNext();
+	}
+	m_newChannels = 0;
+}
+
+TelEngine::String Parser::getLine()
+{
+	TelEngine::String ret;
+	do {
+		char* p = (char*)memchr(m_buf, '\n', m_bufuse);
+		if(p) {
+			++p;
+			size_t len = p - m_buf;
+			ret.append(m_buf, len);
+			memmove(m_buf, p, m_bufuse - len);
+			m_bufuse -= len;
+			m_pos += len;
+			return ret;
+		}
+		if(m_bufuse == m_bufsize) { // overlong line, keep collecting
+			ret.append(m_buf, m_bufuse);
+			m_pos += m_bufuse;
+			m_bufuse = 0;
+		}
+		if(! m_stream || ! m_stream->valid())
+			break;
+		int rd = m_stream->readData(m_buf + m_bufuse, m_bufsize - m_bufuse);
+		if(rd <= 0)
+			break;
+		m_bufuse += rd;
+	} while(m_bufuse);
+	if(m_bufuse) { // last line without newline
+		ret.append(m_buf, m_bufuse);
+		m_pos += m_bufuse;
+		m_bufuse = 0;
+	}
+	return ret;
+}
+
+void Parser::feed(const char* data, size_t len, EntrySink& sink)
+{
+	while(len) {
+		const char* p = (const char*)memchr(data, '\n', len);
+		if(! p) {
+			m_partial.append(data, len);
+			return;
+		}
+		++p;
+		m_partial.append(data, p - data);
+		len -= p - data;
+		data = p;
+		m_pos += m_partial.length();
+		Entry* e = pushLine(m_partial);
+		m_partial.clear();
+		if(e)
+			sink.eat(e);
+	}
+}
+
+void Parser::finish(EntrySink& sink)
+{
+	if(! m_partial.null()) {
+		m_pos += m_partial.length();
+		Entry* e = pushLine(m_partial);
+		m_partial.clear();
+		if(e)
+			sink.eat(e);
+	}
+	Entry* e = finish();
+	if(e)
+		sink.eat(e);
+}
+
+Entry* Parser::finish()
+{
+	if(m_multiline && m_last) // value still open at end of input
+		m_last->setParam(m_multiKey, m_multiValue);
+	m_multiline = false;
+	return setLast(NULL);
+}
+
+Entry* Parser::pushLine(const TelEngine::String& s)
+{
+	Entry* e = parseLine(s);
+	return e ? setLast(e) : NULL;
+}
+
+static const TelEngine::Regexp re1("^Sniffed \\|^Returned ");
+static const TelEngine::Regexp re2("^  param\\['\\(.*\\)'\\] = '\\(.*\\)'");
+static const TelEngine::Regexp re3("^  param\\['\\(.*\\)'\\] = '\\(.*\\)");
+static const TelEngine::Regexp re4("^-----");
+static const TelEngine::Regexp re5("^\\([0-9\\.]\\+ \\)\\?<[a-zA-Z0-9]\\+:[a-zA-Z0-9]\\+> '.*' \\(sending\\|received\\) .* \\(to\\|from\\) \\([0-9\\.]\\+:[0-9]\\+\\)");
+static const TelEngine::Regexp re6("^\\([0-9\\.]\\+ \\)\\?<[a-zA-Z0-9]\\+:[a-zA-Z0-9]\\+> '[a-z]\\+:[0-9\\.]\\+:[0-9]\\+-\\([0-9\\.]\\+:[0-9]\\+\\)' \\(received [0-9]\\+ bytes\\|sending code [0-9]\\+\\)");
+static const TelEngine::Regexp re7("^Yate ([0-9]\\+) is starting ");
+static const TelEngine::Regexp re8("^\\([0-9\\.]\\+ \\)\\?<\\([^ /:>]\\+\\)/Q931:[a-zA-Z]*> .*");
+static const TelEngine::Regexp re9(" time=\\([0-9\\.]\\+\\)");
+static const TelEngine::Regexp re10("^[^']*'[a-z]\\+:\\([0-9\\.]\\+:[0-9]\\+\\)"); // our end of a transport
+static const TelEngine::Regexp re11("call[ _-]\\?ref\\(erence\\)\\?[=: ]\\+\\(0x[0-9a-f]\\+\\|[0-9]\\+\\)", false, true);
+
+/* Our own address from the top Via of a SIP dump: it names us in requests
+ * we send and in responses we receive. Empty if it is not a numeric one */
+static TelEngine::String viaLocal(const TelEngine::String& text)
+{
+	int via = text.find("\nVia:");
+	if(via < 0)
+		via = text.find("\nv:");
+	if(via < 0)
+		return TelEngine::String::empty();
+	int resp = text.find("\nSIP/2.0 ");
+	bool response = resp >= 0 && resp < via;
+	bool sending = text.find("' sending ") >= 0;
+	if(sending == response)
+		return TelEngine::String::empty(); // the peer's Via
+	unsigned int i = text.find(':', via + 1) + 1;
+	while(i < text.length() && text.at(i) == ' ')
+		++i;
+	while(i < text.length() && text.at(i) != ' ' && text.at(i) != '\n') // "SIP/2.0/UDP"
+		++i;
+	while(i < text.length() && text.at(i) == ' ')
+		++i;
+	TelEngine::String addr;
+	bool port = false;
+	for(; i < text.length(); ++i) {
+		char c = text.at(i);
+		if(c == ':')
+			port = true;
+		else if((c < '0' || c > '9') && c != '.')
+			break;
+		addr << c;
+	}
+	if(addr.null() || addr.at(0) == ':')
+		return TelEngine::String::empty();
+	if(! port)
+		addr << ":5060";
+	return addr;
+}
+
+/* Local transport address, used to link several merged nodes. A listener
+ * bound to any address only tells it through its Via */
+static void setLocal(Entry& e)
+{
+	if(e.type() != Entry::NETWORK)
+		return;
+	TelEngine::String s(e.text());
+	if(! s.matches(re10))
+		return;
+	TelEngine::String local = s.matchString(1);
+	if(local.startsWith("0.0.0.0:"))
+		local = viaLocal(e.text());
+	if(! local.null())
+		e.setParam("local", local);
+}
+
+/* Regexp compiles on first use, do it before several threads race for that.
+ * Query's address check is included, Sessions may run on several threads too */
+void Parser::prepare()
+{
+	const TelEngine::Regexp* re[] = { &re1, &re2, &re3, &re4, &re5, &re6, &re7, &re8, &re9, &re10, &re11, &reAddress };
+	for(unsigned int i = 0; i < sizeof(re) / sizeof(re[0]); ++i)
+		re[i]->compile();
+}
+
+/* Value of a SIP header line, full or compact form */
+static bool sipHeader(const TelEngine::String& s, const char* name, const char* compact, TelEngine::String& value)
+{
+	if(! s.startsWith(name, false, true) && ! s.startsWith(compact, false, true))
+		return false;
+	int colon = s.find(':');
+	value = s.substr(colon + 1);
+	value.trimSpaces();
+	return true;
+}
+
+/* Call keys of network entries: SIP Call-ID and top Via branch from the
+ * dump, Q.931 call reference from the Q931 debug text */
+void Parser::netLine(Entry& e, TelEngine::String& s)
+{
+	if(m_q931) {
+		if(! e.getParam(YSTRING("callref")) && s.matches(re11))
+			e.setParam("callref", s.matchString(2).toLower());
+		return;
+	}
+	char c = s.at(0) | 0x20; // cheap reject of other headers and bodies
+	if(c != 'c' && c != 'i' && c != 'v')
+		return;
+	TelEngine::String v;
+	if(sipHeader(s, "Call-ID:", "i:", v)) {
+		if(! e.getParam(YSTRING("callid")))
+			e.setParam("callid", v);
+	} else if(sipHeader(s, "Via:", "v:", v)) {
+		int b = v.find(";branch=");
+		if(b < 0 || e.getParam(YSTRING("branch")))
+			return;
+		v = v.substr(b + 8);
+		int end = 0;
+		while(end < (int)v.length() && v.at(end) != ';' && v.at(end) != ',' && v.at(end) != ' ')
+			++end;
+		e.setParam("branch", v.substr(0, end));
+	}
+}
+
+Entry* Parser::parseLine(TelEngine::String s)
+{
+	//fprintf(stderr, "Parsing: %s\n", s.c_str());
+	if(m_multiline && m_last) { // continuation of multiline value, up to the closing quote
+		int q = s.find('\'');
+		if(q < 0) {
+			addText(s);
+			m_multiValue += s;
+			return NULL;
+		}
+		m_multiValue.append(s.c_str(), q);
+		m_last->setParam(m_multiKey, m_multiValue);
+		m_multiline = false;
+		/* text after the quote is a line of its own, unless it is just the line end */
+		TelEngine::String rest = s.substr(q + 1);
+		TelEngine::String tail(rest);
+		if(tail.trimSpaces().null()) {
+			addText(s);
+			return NULL;
+		}
+		addText(s.substr(0, q + 1));
+		return parseLine(rest);
+	}
+	if(m_verbatimCopy && m_last) {
+		addText(s);
+		if(m_last->type() == Entry::NETWORK)
+			netLine(*m_last, s);
+		if(s.matches(re4))
+			m_verbatimCopy = false;
+		return NULL;
+	}
+	if(s.matches(re2) && m_last && m_last->type() == Entry::MESSAGE) { // simple key = value
+//		fprintf(stderr, "Got param, last: %p, type: %d\n", m_last, m_last ? m_last->type() : -1);
+//		fprintf(stderr, " key: %s, value: %s\n", s.matchString(1).c_str(), s.matchString(2).c_str());
+		addText(s);
+		m_last->setParam(s.matchString(1), s.matchString(2));
+		return NULL;
+	}
+	if(s.matches(re3) && m_last && m_last->type() == Entry::MESSAGE) { // multiline value
+		m_multiKey = s.matchString(1);
+		m_multiValue = s.matchString(2);
+//		fprintf(stderr, "multiline key: %s, value: %s\n", m_multiKey.c_str(), m_multiValue.c_str());
+		addText(s);
+		m_multiline = true;
+		return NULL;
+	}
+	if(s[0] == ' ' && m_last) { // retval && thread
+		addText(s);
+		if(m_last->type() == Entry::NETWORK)
+			netLine(*m_last, s);
+		return NULL;
+	}
+	if(s.matches(re1)) {
+//		fprintf(stderr, "Got message\n");
+		Entry* e = new Entry(Entry::MESSAGE, s);
+		e->setParam("address", s.matchString(4));
+		e->setParam("ts", s.matches(re9) ? s.matchString(1) : TelEngine::String::empty());
+		return e;
+	}
+	if(s.matches(re5)) {
+		Entry* e = new Entry(Entry::NETWORK, s);
+		e->setParam("ts", s.matchString(1).trimBlanks());
+		e->setParam("address", s.matchString(4));
+		m_q931 = false;
+		return e;
+	}
+	bool q931 = false;
+	if(s.matches(re6) || (q931 = s.matches(re8))) {
+		Entry* e = new Entry(Entry::NETWORK, s);
+		e->setParam("ts", s.matchString(1).trimBlanks());
+		e->setParam("address", s.matchString(2));
+		m_q931 = q931;
+		if(q931)
+			netLine(*e, s);
+		return e;
+	}
+	if(s.matches(re4) && m_last) {
+		addText(s);
+		m_verbatimCopy = true;
+		return NULL;
+	}
+	if(s.matches(re7)) {
+		return new Entry(Entry::STARTUP, s);
+	}
+//	fprintf(stderr, "Building UNKNOWN: %s\n", s.c_str());
+	return new Entry(Entry::UNKNOWN, s);
+}
+
+Entry* Parser::get()
+{
+	for(;;) {
+		TelEngine::String s = getLine();
+		if(s.null())
+			return finish(); // EOF
+		Entry* e = pushLine(s);
+		if(e)
+			return e;
+	}
+}
+
+/* Anonymous file in $TMPDIR, it goes away with us */
+static bool openTemp(TelEngine::File& file)
+{
+	const char* dir = ::getenv("TMPDIR");
+	TelEngine::String path(dir && *dir ? dir : "/tmp");
+	path << "/yategrep-XXXXXX";
+	char* tmpl = ::strdup(path);
+	int fd = ::mkstemp(tmpl);
+	if(fd >= 0) {
+		::unlink(tmpl);
+		file.attach(fd);
+	} else
+		fprintf(stderr, "Can not create spool file %s: %s\n", tmpl, ::strerror(errno));
+	::free(tmpl);
+	return file.valid();
+}
+
+bool Spool::open()
+{
+	return openTemp(m_file);
+}
+
+/* Entries go one after another into the current segment. A full one is left
+ * for a segment nothing lives in any more, so the file stays about as big as
+ * the text spilled at once. Entries over a segment get new ones at the end */
+int64_t Spool::place(unsigned int len)
+{
+	unsigned int room = len ? len : 1; // an empty entry still owns its segment
+	int64_t pos = m_end;
+	if(m_segs && pos + room <= ((int64_t)m_cur + 1) << m_segBits) {
+		++m_segLive[m_cur];
+		m_end = pos + len;
+		return pos;
+	}
+	unsigned int need = (unsigned int)(((int64_t)room + (1 << m_segBits) - 1) >> m_segBits);
+	if(m_segs && ! m_segLive[m_cur])
+		m_free[m_freeCount++] = m_cur;
+	unsigned int first;
+	if(need == 1 && m_freeCount)
+		first = m_free[--m_freeCount];
+	else {
+		if(m_segs + need > m_segAlloc) {
+			unsigned int alloc = 2 * m_segAlloc > m_segs + need ? 2 * m_segAlloc : m_segs + need + 16;
+			unsigned int* live = (unsigned int*)::realloc(m_segLive, alloc * sizeof(unsigned int));
+			if(live)
+				m_segLive = live;
+			unsigned int* idle = (unsigned int*)::realloc(m_free, alloc * sizeof(unsigned int));
+			if(idle)
+				m_free = idle;
+			if(! live || ! idle)
+				return -1;
+			m_segAlloc = alloc;
+		}
+		first = m_segs;
+		m_segs += need;
+		for(unsigned int i = first; i < m_segs; ++i)
+			m_segLive[i] = 0;
+	}
+	for(unsigned int i = first; i < first + need; ++i)
+		++m_segLive[i];
+	m_cur = first + need - 1;
+	pos = (int64_t)first << m_segBits;
+	m_end = pos + len;
+	return pos;
+}
+
+void Spool::unuse(int64_t pos, unsigned int len)
+{
+	unsigned int last = (unsigned int)((pos + (len ? len : 1) - 1) >> m_segBits);
+	for(unsigned int i = (unsigned int)(pos >> m_segBits); i <= last; ++i)
+		if(! --m_segLive[i] && i != m_cur)
+			m_free[m_freeCount++] = i;
+}
+
+bool Spool::spill(Entry& e)
+{
+	if(! m_file.valid() && ! open())
+		return false;
+	unsigned int len = e.text().length();
+	int64_t pos = place(len);
+	if(pos < 0) {
+		fputs("Out of memory for spool file map\n", stderr);
+		return false;
+	}
+	if(m_file.seek(TelEngine::Stream::SeekBegin, pos) != pos || m_file.writeData(e.text().c_str(), len) != (int)len) {
+		fprintf(stderr, "Spool file write failed: %s\n", ::strerror(errno));
+		unuse(pos, len);
+		return false;
+	}
+	e.spilled(pos, len);
+	++m_live;
+	discharge(len);
+	static_cast<TelEngine::String&>(e).clear();
+	return true;
+}
+
+bool Spool::restore(Entry& e)
+{
+	unsigned int len = e.spillLen();
+	char* buf = (char*)::malloc(len + 1);
+	int got = 0;
+	if(buf && m_file.seek(TelEngine::Stream::SeekBegin, e.spillPos()) == e.spillPos()) {
+		int rd;
+		while(got < (int)len && (rd = m_file.readData(buf + got, len - got)) > 0)
+			got += rd;
+	}
+	bool ok = (got == (int)len);
+	if(ok)
+		e.assign(buf, len);
+	else
+		fprintf(stderr, "Spool file read failed, lost %u bytes of log entry\n", len);
+	::free(buf);
+	release(e);
+	return ok;
+}
+
+void Spool::release(Entry& e)
+{
+	unuse(e.spillPos(), e.spillLen());
+	e.spilled(-1, 0);
+	if(--m_live)
+		return;
+	/* nothing alive in the file, start over and give the disk back */
+	m_end = 0;
+	m_segs = 0;
+	m_freeCount = 0;
+	if(::ftruncate(m_file.handle(), 0))
+		fprintf(stderr, "Spool file truncate failed: %s\n", ::strerror(errno));
+}
+
+void JsonOut::raw(const char* s, size_t len)
+{
+	if(len > m_bufsize - m_bufuse) {
+		flush();
+		if(len > m_bufsize) {
+			m_strm.writeData(s, len);
+			return;
+		}
+	}
+	::memcpy(m_buf + m_bufuse, s, len);
+	m_bufuse += len;
+}
+
+/* True if any of 8 packed bytes is a control character, quote, backslash or
+ * not ASCII (word-at-a-time "has byte less than"/"has zero byte" tests) */
+static inline bool jsonSpecial8(u_int64_t v)
+{
+	const u_int64_t ones = 0x0101010101010101ULL;
+	const u_int64_t high = 0x8080808080808080ULL;
+	u_int64_t q = v ^ (ones * '"');
+	u_int64_t b = v ^ (ones * '\\');
+	return ((((v - ones * 0x20) & ~v) | ((q - ones) & ~q) | ((b - ones) & ~b) | v) & high) != 0;
+}
+
+/* Length of the well-formed UTF-8 sequence at p, 0 if there is none */
+static inline unsigned int utf8Length(const unsigned char* p, const unsigned char* end)
+{
+	unsigned int len;
+	unsigned char lo = 0x80; // range of the second byte, excludes overlongs and surrogates
+	unsigned char hi = 0xbf;
+	if(*p >= 0xc2 && *p <= 0xdf)
+		len = 2;
+	else if(*p >= 0xe0 && *p <= 0xef) {
+		len = 3;
+		if(*p == 0xe0)
+			lo = 0xa0;
+		else if(*p == 0xed)
+			hi = 0x9f;
+	} else if(*p >= 0xf0 && *p <= 0xf4) {
+		len = 4;
+		if(*p == 0xf0)
+			lo = 0x90;
+		else if(*p == 0xf4)
+			hi = 0x8f;
+	} else
+		return 0;
+	if(end - p < (int)len || p[1] < lo || p[1] > hi)
+		return 0;
+	for(unsigned int i = 2; i < len; ++i)
+		if((p[i] & 0xc0) != 0x80)
+			return 0;
+	return len;
+}
+
+void JsonOut::string(const char* s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	raw("\"", 1);
+	const char* end = s + len;
+	while(s < end) {
+		const char* p = s;
+		for(;;) {
+			/* skip plain text a word at a time, then finish byte by byte */
+			while(end - p >= 8) {
+				u_int64_t v;
+				::memcpy(&v, p, 8);
+				if(jsonSpecial8(v))
+					break;
+				p += 8;
+			}
+			while(p < end && (unsigned char)*p >= 0x20 && (unsigned char)*p < 0x80 && *p != '"' && *p != '\\')
+				++p;
+			unsigned int u = (p < end && (unsigned char)*p >= 0x80) ? utf8Length((const unsigned char*)p, (const unsigned char*)end) : 0;
+			if(! u)
+				break;
+			p += u;
+		}
+		if(p != s)
+			raw(s, p - s);
+		if(p == end)
+			break;
+		if((unsigned char)*p >= 0x80) { // not UTF-8, consumers would reject the whole line
+			raw("\\ufffd", 6);
+			s = p + 1;
+			continue;
+		}
+		char esc[6] = { '\\', *p, 0, 0, 0, 0 };
+		size_t elen = 2;
+		switch(*p) {
+			case '"':
+			case '\\':
+				break;
+			case '\n':
+				esc[1] = 'n';
+				break;
+			case '\r':
+				esc[1] = 'r';
+				break;
+			case '\t':
+				esc[1] = 't';
+				break;
+			case '\b':
+				esc[1] = 'b';
+				break;
+			case '\f':
+				esc[1] = 'f';
+				break;
+			default:
+				esc[1] = 'u';
+				esc[2] = esc[3] = '0';
+				esc[4] = hex[(*p >> 4) & 0x0f];
+				esc[5] = hex[*p & 0x0f];
+				elen = 6;
+				break;
+		}
+		raw(esc, elen);
+		s = p + 1;
+	}
+	raw("\"", 1);
+}
+
+void Grep::push(Entry* e, Query& query, EntrySink& sink)
+{
+	query.learn(*e);
+	++m_seq;
+	if(e->type() == Entry::STARTUP) {
+		if(e->node()) // one of merged nodes restarted, others go on
+			query.flush(*e->node());
+		else {
+			flushBuffer(sink);
+			query.flush();
+			if(m_ghosts) // channel ids start over
+				::memset(m_ghosts, 0, (m_ghostMask + 1) * sizeof(Ghost));
+		}
+	}
+	if(query.matches(*e)) {
+		e->mark();
+		++m_markedCount;
+		if(e->type() == Entry::MESSAGE)
+			m_lastMarked = e;
+#if 1 /* DEEP SEARCH */
+		TelEngine::ObjList added;
+		if(query.update(*e, true, &added)) {
+			bool modified;
+			do {
+				modified = false;
+				size_t age = m_buf.count();
+				for(Entry* t = m_buf.head(); t && !modified; t = t->next(), --age) {
+					if(t->marked())
+						continue;
+					if(! query.matches(*t, true))
+						continue;
+					if(age > m_base) // grown backlog is still paying off
+						m_lastMiss = m_seq;
+					t->mark();
+					++m_markedCount;
+					if(e->type() == Entry::MESSAGE)
+						m_lastMarked = e;
+					modified = query.update(*t, false, &added);
+				}
+			} while(modified);
+			missed(added);
+		}
+#endif
+	}
+	e = m_buf.pushpop(e);
+	while(e) {
+		if(! e->marked())
+			ghost(*e, m_seq - m_buf.count());
+		sink.eat(e);
+		if(e == m_lastMarked) { // no more marked MESSAGEs in buffer
+			m_lastMarked = NULL;
+			/* we flush query here to stop marking useless NETWORK messages */
+			query.flush();
+		}
+		e = (m_buf.count() > m_buf.size()) ? m_buf.pop() : NULL; // drain after shrinking
+	}
+	if(m_cap && m_buf.size() > m_base && m_seq - m_lastMiss > 4 * m_buf.size()) { // quiet stretch
+		m_buf.size(m_buf.size() / 2 > m_base ? m_buf.size() / 2 : m_base);
+		m_lastMiss = m_seq;
+	}
+}
+
+static inline u_int32_t ghostHash(u_int32_t h, const char* s, unsigned int len)
+{
+	while(len--)
+		h = (h ^ (unsigned char)*s++) * 16777619; // FNV-1a
+	return h;
+}
+
+/* Only channel ids are remembered: addresses are shared by all calls of a
+ * peer and would make every query look like it missed something */
+void Grep::ghost(const Entry& e, u_int64_t seq)
+{
+	if(! m_ghosts) {
+		size_t want = horizon();
+		u_int32_t slots = 1024;
+		while(slots < want && slots < 65536)
+			slots <<= 1;
+		m_ghosts = new Ghost[slots];
+		::memset(m_ghosts, 0, slots * sizeof(Ghost));
+		m_ghostMask = slots - 1;
+	}
+	unsigned int n = e.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s || ! isChannelParam(s->name()))
+			continue;
+		u_int32_t h = 2166136261u;
+		if(e.node()) { // same key as Query keeps
+			h = ghostHash(h, e.node()->c_str(), e.node()->length());
+			h = ghostHash(h, "|", 1);
+		}
+		h = ghostHash(h, s->c_str(), s->length());
+		Ghost& g = m_ghosts[h & m_ghostMask];
+		if(g.seq && g.hash == h && seq - g.seq < horizon())
+			continue; // keep the oldest sighting, it tells how far back the call goes
+		g.hash = h;
+		g.seq = seq;
+	}
+}
+
+/* Newly learned query keys that were seen in entries already gone: grow the backlog so the next call fits */
+void Grep::missed(const TelEngine::ObjList& keys)
+{
+	if(! m_ghosts)
+		return;
+	for(TelEngine::ObjList* o = keys.skipNull(); o; o = o->skipNext()) {
+		const TelEngine::String& k = o->get()->toString();
+		u_int32_t h = ghostHash(2166136261u, k.c_str(), k.length());
+		const Ghost& g = m_ghosts[h & m_ghostMask];
+		if(! g.seq || g.hash != h || m_seq - g.seq >= horizon())
+			continue;
+		size_t need = m_seq - g.seq + 1;
+		if(need > m_needed)
+			m_needed = need;
+		m_lastMiss = m_seq;
+		if(m_cap > m_buf.size()) {
+			size_t grow = 2 * m_buf.size() > need ? 2 * m_buf.size() : need;
+			m_buf.size(grow < m_cap ? grow : m_cap);
+		}
+	}
+}
+
+void Grep::flushBuffer(EntrySink& sink)
+{
+	Entry* e;
+	while((e = m_buf.pop()))
+		sink.eat(e);
+	m_lastMarked = NULL;
+}
+
+void Writer::eat(Entry* entry)
+{
+	if(entry->marked()) {
+		if(! m_showflag && m_skipcount)
+			outputSeparator();
+		m_showflag = true;
+		m_tailcount = 0;
+	} else if(! m_context)
+		m_showflag = false;
+
+	if(m_buf) {
+		entry = m_buf->pushpop(entry);
+		if(! entry)
+			return;
+	}
+	emit(entry);
+}
+
+void Writer::finish()
+{
+	Entry* entry;
+	while(m_buf && (entry = m_buf->pop()))
+		emit(entry);
+	if(m_skipcount)
+		outputSeparator();
+}
+
+/* Entry is leaving context buffer: show or skip it */
+void Writer::emit(Entry* entry)
+{
+	if(m_showflag) {
+		if(entry->spilled())
+			m_spool->restore(*entry);
+		output(*entry);
+	} else
+		++m_skipcount;
+
+	if(m_context) {
+		if(entry->marked()) {
+			m_tailcount = 0;
+		} else {
+			if(++m_tailcount == m_context)
+				m_showflag = false;
+		}
+	}
+	if(entry->spilled())
+		m_spool->release(*entry);
+	delete entry;
+}
+
+/* "[node] " in front of every line of merged entries */
+static TelEngine::String nodeText(const Entry& e)
+{
+	TelEngine::String prefix("[");
+	prefix << *e.node() << "] ";
+	TelEngine::String s;
+	const char* p = e.text().c_str();
+	while(p && *p) {
+		const char* nl = ::strchr(p, '\n');
+		unsigned int len = nl ? nl - p + 1 : ::strlen(p);
+		s << prefix;
+		s.append(p, len);
+		p += len;
+	}
+	return s;
+}
+
+void Writer::output(const Entry& e)
+{
+	if(m_format == JSON) {
+		outputJson(e);
+		m_skipcount = 0;
+		return;
+	}
+	if(m_format == BINARY) {
+		outputBinary(e);
+		m_skipcount = 0;
+		return;
+	}
+	if(m_format == XHTML) {
+		TelEngine::String s("<pre class=\"");
+		s << Entry::typeString(e.type());
+		if(e.marked())
+			s << " marked";
+		s << "\">";
+		m_strm->writeData(s);
+		if(e.node())
+			HtmlFilter(*m_strm, true).writeData(nodeText(e));
+		else
+			HtmlFilter(*m_strm, true).writeData(e);
+		m_strm->writeData("</pre>\n");
+	}
+	else { // no xhtml
+		if(e.marked() && m_context)
+			m_strm->writeData("\x1B[1m");
+		if(e.node())
+			m_strm->writeData(nodeText(e));
+		else
+			m_strm->writeData(e);
+		if(e.marked() && m_context)
+			m_strm->writeData("\x1B[0m");
+	}
+	m_skipcount = 0;
+}
+
+/* One JSON object per line: type, marked flag, timestamp, address, node tag if merging, params and raw text */
+void Writer::outputJson(const Entry& e)
+{
+	JsonOut out(*m_strm);
+	out.raw("{\"type\":\"");
+	out.raw(Entry::typeString(e.type()));
+	out.raw(e.marked() ? "\",\"marked\":true,\"ts\":" : "\",\"marked\":false,\"ts\":");
+	out.string(e["ts"]);
+	out.raw(",\"address\":");
+	out.string(e["address"]);
+	if(e.node()) {
+		out.raw(",\"node\":");
+		out.string(*e.node());
+	}
+	out.raw(",\"params\":{");
+	bool first = true;
+	unsigned int n = e.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s || s->name() == YSTRING("ts"))
+			continue;
+		if(! first)
+			out.raw(",");
+		first = false;
+		out.string(s->name());
+		out.raw(":");
+		out.string(*s);
+	}
+	out.raw("},\"text\":");
+	out.string(e);
+	out.raw("}\n");
+}
+
+static inline unsigned char* putU16(unsigned char* p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	return p + 2;
+}
+
+static inline unsigned char* putU32(unsigned char* p, u_int32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+	return p + 4;
+}
+
+static inline unsigned int fitU16(unsigned int len, bool& cut)
+{
+	if(len <= 0xffff)
+		return len;
+	cut = true;
+	return 0xffff;
+}
+
+/* Length-prefixed little-endian record:
+ *  u32 length of the rest, u8 type, u8 flags (bit 0: marked, bit 1: node tag present,
+ *  bit 2: truncated), u16 param count, node tag as (u16 length, tag) if flagged,
+ *  params as (u16 name length, name, u32 value length, value), u32 text length, text.
+ * Tags and names over 64 KB are cut and params past the 65535th dropped, with bit 2 set */
+void Writer::outputBinary(const Entry& e)
+{
+	unsigned int n = e.length();
+	unsigned int params = 0;
+	bool cut = false;
+	unsigned int tag = e.node() ? fitU16(e.node()->length(), cut) : 0;
+	size_t len = 4 + 1 + 1 + 2 + 4 + e.text().length();
+	if(e.node())
+		len += 2 + tag;
+	for(unsigned int i = 0; i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s)
+			continue;
+		if(params == 0xffff) {
+			cut = true;
+			break;
+		}
+		++params;
+		len += 2 + fitU16(s->name().length(), cut) + 4 + s->length();
+	}
+	if(len > m_binsize) {
+		unsigned char* buf = (unsigned char*)::realloc(m_binbuf, len);
+		if(! buf) {
+			fprintf(stderr, "Out of memory, lost binary record of %u bytes\n", (unsigned int)len);
+			return;
+		}
+		m_binbuf = buf;
+		m_binsize = len;
+	}
+	unsigned char* p = putU32(m_binbuf, len - 4);
+	*p++ = e.type();
+	*p++ = (e.marked() ? 1 : 0) | (e.node() ? 2 : 0) | (cut ? 4 : 0);
+	p = putU16(p, params);
+	if(e.node()) {
+		p = putU16(p, tag);
+		::memcpy(p, e.node()->c_str(), tag);
+		p += tag;
+	}
+	for(unsigned int i = 0; params && i < n; ++i) {
+		TelEngine::NamedString* s = e.getParam(i);
+		if(! s)
+			continue;
+		--params;
+		unsigned int name = s->name().length() > 0xffff ? 0xffff : s->name().length();
+		p = putU16(p, name);
+		::memcpy(p, s->name().c_str(), name);
+		p += name;
+		p = putU32(p, s->length());
+		::memcpy(p, s->c_str(), s->length());
+		p += s->length();
+	}
+	p = putU32(p, e.text().length());
+	::memcpy(p, e.text().c_str(), e.text().length());
+	m_strm->writeData(m_binbuf, len);
+}
+
+void Writer::outputSeparator()
+{
+	if(m_format == BINARY) {
+		m_skipcount = 0;
+		return;
+	}
+	TelEngine::String msg;
+	if(m_format == JSON)
+		msg << "{\"type\":\"skipped\",\"count\":" << m_skipcount << "}";
+	else {
+		if(m_format == XHTML)
+			msg << "<div class=\"separator\">";
+		msg << " ... skipped " << m_skipcount << " log entries ...";
+		if(m_format == XHTML)
+			msg << "</div>";
+	}
+	msg << "\n";
+	m_strm->writeData(msg);
+	m_skipcount = 0;
+}
+
+/* Message name from the first line of a sniffed message */
+static bool isMessage(const Entry& e, const char* name)
+{
+	const TelEngine::String& t = e.text();
+	int q = t.find('\'');
+	unsigned int len = ::strlen(name);
+	return q >= 0 && q + 1 + len < t.length() && ! ::strncmp(t.c_str() + q + 1, name, len) && t.at(q + 1 + len) == '\'';
+}
+
+CallFile* Splitter::watch(const TelEngine::String& billid)
+{
+	TelEngine::ObjList* o = m_calls.find(billid);
+	if(o)
+		return static_cast<CallFile*>(o->get());
+	TelEngine::String path(m_dir);
+	path << "/";
+	for(unsigned int i = 0; i < billid.length(); ++i) // billid is not ours, keep it inside m_dir
+		path << ((billid.at(i) == '/' || billid.at(i) == '\\') ? '_' : billid.at(i));
+	path << (m_format == Writer::JSON ? ".jsonl" : (m_format == Writer::XHTML ? ".html" : ".log"));
+	CallFile* call = new CallFile(billid, m_backlog);
+	if(! call->open(path)) {
+		fprintf(stderr, "Can not open %s: %s\n", path.c_str(), ::strerror(errno));
+		delete call;
+		return NULL;
+	}
+	call->writer().format(m_format);
+	m_calls.append(call);
+	return call;
+}
+
+bool Splitter::unwatch(const TelEngine::String& billid)
+{
+	TelEngine::ObjList* o = m_calls.find(billid);
+	if(! o)
+		return false;
+	o->remove(); // CallFile destructor flushes the session
+	return true;
+}
+
+/* Another call's billid means another call's channels, nobody else would
+ * select it. The entry is copied only for calls past the first */
+void Splitter::eat(Entry* entry)
+{
+	const TelEngine::String& billid = (*entry)[YSTRING("billid")];
+	if(billid.null()) {
+		for(TelEngine::ObjList* o = m_calls.skipNull(); o && entry; ) {
+			TelEngine::ObjList* next = o->skipNext();
+			static_cast<CallFile*>(o->get())->session().feed(next ? new Entry(*entry) : entry);
+			if(! next)
+				entry = NULL;
+			o = next;
+		}
+		delete entry;
+		return;
+	}
+	TelEngine::ObjList* o = m_calls.find(billid);
+	if(! o) {
+		delete entry;
+		return;
+	}
+	CallFile* call = static_cast<CallFile*>(o->get());
+	/* cdrbuild sends one CDR per channel, all with the call's billid */
+	bool close = entry->type() == Entry::MESSAGE && isMessage(*entry, "call.cdr")
+		&& call->cdr((*entry)[YSTRING("chan")], (*entry)[YSTRING("operation")] == YSTRING("finalize"));
+	call->session().feed(entry); // may be gone already
+	if(close)
+		unwatch(call->toString());
+}
+
+namespace {
+
+class NodeReader: public TelEngine::Thread
+{
+public:
+	NodeReader(NodeInput* input)
+		: TelEngine::Thread("NodeReader")
+		, m_input(input)
+		{ m_input->ref(); }
+	virtual ~NodeReader()
+		{ TelEngine::destruct(m_input); }
+	virtual void run()
+		{ m_input->read(); }
+private:
+	NodeInput* m_input;
+};
+
+}; // anonymous namespace
+
+NodeInput::NodeInput(const char* tag, const char* path, size_t readahead)
+	: m_tag(tag)
+	, m_path(path)
+	, m_readahead(readahead ? readahead : 1)
+	, m_mutex(false, "NodeInput")
+	, m_ready(1, "NodeInput::ready", 0)
+	, m_space(1, "NodeInput::space", 0)
+	, m_queue(0)
+	, m_local(0)
+	, m_eof(false)
+	, m_stop(false)
+{
+}
+
+NodeInput::~NodeInput()
+{
+	Entry* e;
+	while((e = m_queue.pop()))
+		delete e;
+	while((e = m_local.pop()))
+		delete e;
+}
+
+bool NodeInput::start()
+{
+	if(! m_file.openPath(m_path)) {
+		fprintf(stderr, "Can not open %s\n", m_path.c_str());
+		return false;
+	}
+	return (new NodeReader(this))->startup();
+}
+
+/* Tags entries with our node and a merge time. Entries without a timestamp
+ * (startup banners, unknown lines) keep the place they had in their file */
+void NodeInput::read()
+{
+	Parser parser(m_file);
+	LogBuf batch(0);
+	double last = 0;
+	Entry* e;
+	while(! m_stop && (e = parser.get())) {
+		e->node(&m_tag);
+		last = (*e)["ts"].toDouble(last);
+		e->time(last);
+		setLocal(*e);
+		batch.push(e);
+		if(batch.count() >= 64)
+			put(batch);
+	}
+	put(batch);
+	while((e = batch.pop())) // stopped
+		delete e;
+	m_mutex.lock();
+	m_eof = true;
+	m_mutex.unlock();
+	m_ready.unlock();
+}
+
+void NodeInput::put(LogBuf& batch)
+{
+	while(! batch.empty() && ! m_stop) {
+		m_mutex.lock();
+		Entry* e;
+		while(m_queue.count() < m_readahead && (e = batch.pop()))
+			m_queue.push(e);
+		bool full = ! batch.empty();
+		m_mutex.unlock();
+		m_ready.unlock();
+		if(full) // timed wait covers a wakeup we raced with
+			m_space.lock(TelEngine::Thread::idleUsec());
+	}
+}
+
+Entry* NodeInput::get()
+{
+	Entry* e = m_local.pop();
+	if(e)
+		return e;
+	for(;;) {
+		m_mutex.lock();
+		while((e = m_queue.pop()))
+			m_local.push(e);
+		bool eof = m_eof;
+		m_mutex.unlock();
+		m_space.unlock();
+		e = m_local.pop();
+		if(e || eof)
+			return e;
+		m_ready.lock(TelEngine::Thread::idleUsec());
+	}
+}
+
+Merger::~Merger()
+{
+	for(TelEngine::ObjList* o = m_inputs.skipNull(); o; o = o->skipNext())
+		static_cast<NodeInput*>(o->get())->stop();
+	m_inputs.clear();
+}
+
+bool Merger::add(const char* tag, const char* path)
+{
+	if(m_inputs.find(tag)) {
+		fprintf(stderr, "Duplicate node tag '%s'\n", tag);
+		return false;
+	}
+	m_inputs.append(new NodeInput(tag, path, m_readahead));
+	return true;
+}
+
+namespace {
+
+struct MergeHead
+{
+	Entry* entry;
+	NodeInput* input;
+	unsigned int index; /**< keeps ties in command-line order */
+};
+
+inline bool mergeBefore(const MergeHead& a, const MergeHead& b)
+{
+	if(a.entry->time() != b.entry->time())
+		return a.entry->time() < b.entry->time();
+	return a.index < b.index;
+}
+
+void siftDown(MergeHead* heap, unsigned int size, unsigned int i)
+{
+	for(;;) {
+		unsigned int m = i;
+		unsigned int l = 2 * i + 1;
+		if(l < size && mergeBefore(heap[l], heap[m]))
+			m = l;
+		if(l + 1 < size && mergeBefore(heap[l + 1], heap[m]))
+			m = l + 1;
+		if(m == i)
+			return;
+		MergeHead t = heap[i];
+		heap[i] = heap[m];
+		heap[m] = t;
+		i = m;
+	}
+}
+
+}; // anonymous namespace
+
+/* Binary heap of each node's next entry, smallest timestamp goes first */
+void Merger::run(Session& session)
+{
+	Parser::prepare();
+	unsigned int count = m_inputs.count();
+	MergeHead* heap = new MergeHead[count];
+	unsigned int size = 0;
+	unsigned int index = 0;
+	for(TelEngine::ObjList* o = m_inputs.skipNull(); o; o = o->skipNext(), ++index) {
+		NodeInput* input = static_cast<NodeInput*>(o->get());
+		if(! input->start())
+			continue;
+		Entry* e = input->get();
+		if(! e)
+			continue;
+		heap[size].entry = e;
+		heap[size].input = input;
+		heap[size].index = index;
+		++size;
+	}
+	for(unsigned int i = size / 2; i-- > 0; )
+		siftDown(heap, size, i);
+	while(size) {
+		session.feed(heap[0].entry);
+		heap[0].entry = heap[0].input->get();
+		if(! heap[0].entry)
+			heap[0] = heap[--size];
+		siftDown(heap, size, 0);
+	}
+	delete[] heap;
+}
+
+/* 64-bit FNV-1a, then mixed: sketches and filters take bits from both halves */
+static u_int64_t valueHash(const char* s, unsigned int len)
+{
+	u_int64_t h = 14695981039346656037ULL;
+	while(len--)
+		h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/* Distinct value hashes of one region, collected while it is parsed so its
+ * filter can be sized to them */
+class HashSet
+{
+public:
+	HashSet()
+		: m_slots(NULL), m_mask(0), m_count(0)
+		{ }
+	~HashSet()
+		{ delete[] m_slots; }
+	void add(u_int64_t h)
+	{
+		if(! h)
+			h = 1; // 0 marks a free slot
+		if(2 * (m_count + 1) > m_mask + 1)
+			grow();
+		u_int32_t i = (u_int32_t)h & m_mask;
+		while(m_slots[i] && m_slots[i] != h)
+			i = (i + 1) & m_mask;
+		if(! m_slots[i]) {
+			m_slots[i] = h;
+			++m_count;
+		}
+	}
+	unsigned int count() const
+		{ return m_count; }
+	unsigned int size() const
+		{ return m_slots ? m_mask + 1 : 0; }
+	u_int64_t slot(unsigned int i) const /**< 0 if free */
+		{ return m_slots[i]; }
+private:
+	void grow()
+	{
+		u_int64_t* old = m_slots;
+		unsigned int n = size();
+		m_mask = n ? 2 * n - 1 : 1023;
+		m_slots = new u_int64_t[m_mask + 1];
+		::memset(m_slots, 0, (m_mask + 1) * sizeof(u_int64_t));
+		m_count = 0;
+		for(unsigned int i = 0; i < n; ++i)
+			if(old[i])
+				add(old[i]);
+		delete[] old;
+	}
+	u_int64_t* m_slots;
+	u_int32_t m_mask;
+	unsigned int m_count;
+};
+
+/* Bloom filter of the billids, channel ids and addresses logged in one
+ * region, 4 probes per value. 10 to 20 bits per distinct value keep false
+ * positives at 1% or less however big the region is */
+class SegmentFilter
+{
+public:
+	SegmentFilter(unsigned int bits)
+		: m_bits(bits)
+		, m_data(new unsigned char[bytes()])
+		{ ::memset(m_data, 0, bytes()); }
+	~SegmentFilter()
+		{ delete[] m_data; }
+	static unsigned int bitsFor(unsigned int values) /**< log2 of filter size for that many distinct values */
+	{
+		unsigned int b = minBits;
+		while(b < maxBits && ((u_int64_t)1 << b) < (u_int64_t)values * 10)
+			++b;
+		return b;
+	}
+	unsigned int bytes() const
+		{ return (unsigned int)((u_int64_t)1 << (m_bits - 3)); }
+	void add(u_int64_t h)
+	{
+		for(unsigned int i = 0; i < 4; ++i) {
+			u_int32_t bit = probe(h, i);
+			m_data[bit >> 3] |= 1 << (bit & 7);
+		}
+	}
+	void add(const HashSet& values)
+	{
+		for(unsigned int i = 0; i < values.size(); ++i)
+			if(values.slot(i))
+				add(values.slot(i));
+	}
+	bool check(const TelEngine::String& value) const /**< @return false if value was surely never added */
+	{
+		u_int64_t h = valueHash(value.c_str(), value.length());
+		if(! h)
+			h = 1; // as HashSet keeps it
+		for(unsigned int i = 0; i < 4; ++i) {
+			u_int32_t bit = probe(h, i);
+			if(! (m_data[bit >> 3] & (1 << (bit & 7))))
+				return false;
+		}
+		return true;
+	}
+	const static unsigned int minBits = 13;
+	const static unsigned int maxBits = 32;
+	unsigned int m_bits;
+	unsigned char* m_data;
+private:
+	u_int32_t probe(u_int64_t h, unsigned int i) const
+		{ return ((u_int32_t)h + i * ((u_int32_t)(h >> 32) | 1)) & (u_int32_t)(((u_int64_t)1 << m_bits) - 1); }
+};
+
+/* Values a region can not match the query without, if the query has them */
+static bool isIndexed(const TelEngine::NamedString& s)
+{
+	return s.name() == YSTRING("billid") || isChannelParam(s.name()) || isAddressParam(s);
+}
+
+/* Output of one part. Written through once the part is at the head of the
+ * output order, until then kept in memory and past a limit in a spool file */
+class PartOut: public TelEngine::Stream
+{
+public:
+	PartOut()
+		: m_mutex(false, "PartOut")
+		, m_out(NULL)
+		, m_data(0x10000)
+		, m_limit((size_t)16 << 20)
+		, m_spilled(0)
+		{ }
+	virtual bool terminate()
+		{ return true; }
+	virtual bool valid() const
+		{ return true; }
+	virtual int writeData(const void* buffer, int length);
+	virtual int readData(void* buffer, int length)
+		{ return 0; }
+	using TelEngine::Stream::writeData;
+	void limit(size_t bytes)
+		{ m_limit = bytes; }
+	void live(TelEngine::Stream& out); /**< Writes what was kept to out, later writes go straight there */
+private:
+	TelEngine::Mutex m_mutex;
+	TelEngine::Stream* m_out;
+	TelEngine::DataBlock m_data;
+	TelEngine::File m_file;
+	size_t m_limit;
+	int64_t m_spilled;
+};
+
+int PartOut::writeData(const void* buffer, int length)
+{
+	if(length <= 0)
+		return 0;
+	TelEngine::Lock lock(m_mutex);
+	if(m_out)
+		return m_out->writeData(buffer, length);
+	m_data.append(const_cast<void*>(buffer), length);
+	if(m_data.length() <= m_limit)
+		return length;
+	if((m_file.valid() || openTemp(m_file))
+		&& m_file.writeData(m_data.data(), m_data.length()) == (int)m_data.length()) {
+		m_spilled += m_data.length();
+		m_data.clear();
+		return length;
+	}
+	if(m_file.valid())
+		fprintf(stderr, "Spool file write failed: %s\n", ::strerror(errno));
+	m_limit = (size_t)-1; // keep the rest in memory then
+	return length;
+}
+
+void PartOut::live(TelEngine::Stream& out)
+{
+	TelEngine::Lock lock(m_mutex);
+	if(m_spilled && m_file.seek(TelEngine::Stream::SeekBegin, 0) == 0) {
+		char buf[65536];
+		int rd;
+		for(int64_t left = m_spilled; left > 0; left -= rd) { // a failed write may have left more
+			rd = m_file.readData(buf, left < (int64_t)sizeof(buf) ? (int)left : (int)sizeof(buf));
+			if(rd <= 0) {
+				fprintf(stderr, "Spool file read failed: %s\n", ::strerror(errno));
+				break;
+			}
+			out.writeData(buf, rd);
+		}
+	}
+	m_file.terminate();
+	if(m_data.length())
+		out.writeData(m_data.data(), m_data.length());
+	m_data.clear();
+	m_out = &out;
+}
+
+/* One file, or a startup-delimited part of one */
+class FileTask: public TelEngine::GenObject
+{
+public:
+	FileTask(const char* path, int64_t begin, int64_t end)
+		: m_path(path)
+		, m_begin(begin)
+		, m_end(end)
+		, m_done(false)
+		, m_skipped(false)
+		, m_needed(0)
+		, m_split(false)
+		, m_filter(NULL)
+		, m_indexed(false)
+		, m_built(false)
+		, m_size(0)
+		, m_mtime(0)
+		{ }
+	~FileTask()
+		{ delete m_filter; }
+	TelEngine::String m_path;
+	int64_t m_begin;
+	int64_t m_end;
+	PartOut m_out;
+	bool m_done;
+	bool m_skipped; /**< Query value not even in the text */
+	size_t m_needed;
+	bool m_split; /**< Runs to end of file for now, is cut at the first startup past region size */
+	SegmentFilter* m_filter;
+	bool m_indexed; /**< m_filter was loaded from the index, else it is built while parsing */
+	bool m_built;
+	int64_t m_size; /**< Of the whole file when added, to validate its index */
+	unsigned int m_mtime;
+};
+
+/* Tasks are handed out from the front, stolen from the back */
+struct TaskDeque
+{
+	TaskDeque()
+		: tasks(NULL), head(0), tail(0)
+		{ }
+	~TaskDeque()
+		{ delete[] tasks; }
+	TelEngine::Mutex mutex;
+	FileTask** tasks;
+	unsigned int head;
+	unsigned int tail;
+};
+
+namespace {
+
+/* Notes indexed values of every parsed entry on their way to the session, if any */
+class FilterTap: public EntrySink
+{
+public:
+	FilterTap(HashSet* values, Session* session)
+		: m_values(values)
+		, m_session(session)
+		{ }
+	virtual void eat(Entry* entry)
+	{
+		unsigned int n = entry->length();
+		for(unsigned int i = 0; i < n; ++i) {
+			const TelEngine::NamedString* s = entry->getParam(i);
+			if(s && ! s->null() && isIndexed(*s))
+				m_values->add(valueHash(s->c_str(), s->length()));
+		}
+		if(m_session)
+			m_session->feed(entry);
+		else
+			delete entry;
+	}
+private:
+	HashSet* m_values;
+	Session* m_session;
+};
+
+class PoolWorker: public TelEngine::Thread
+{
+public:
+	PoolWorker(GrepPool* pool, unsigned int worker)
+		: TelEngine::Thread("GrepPool")
+		, m_pool(pool)
+		, m_worker(worker)
+		{ }
+	virtual void run()
+		{ m_pool->work(m_worker); }
+private:
+	GrepPool* m_pool;
+	unsigned int m_worker;
+};
+
+/* One pass over a region: is the needle in it, and where does it end. If
+ * split is not negative the region ends at the first "Yate (...) is starting"
+ * line at or after split, else it runs to end */
+int64_t scanRegion(TelEngine::File& f, int64_t begin, int64_t end, int64_t split, const TelEngine::String* needle, bool& found)
+{
+	static const char mark[] = "\nYate (";
+	const unsigned int mlen = sizeof(mark) - 1;
+	const unsigned int keep = 64; // enough of the line to check with re7
+	char buf[65536];
+	found = ! needle;
+	if(found && split < 0)
+		return end;
+	if(f.seek(TelEngine::Stream::SeekBegin, begin) < 0) {
+		found = true;
+		return end;
+	}
+	unsigned int carry = (needle ? needle->length() : 1) - 1;
+	if(split >= 0 && carry < mlen + keep)
+		carry = mlen + keep;
+	int64_t pos = begin; // file offset of buf[0]
+	unsigned int have = 0;
+	bool eof = false;
+	while(! eof) {
+		int64_t left = end - pos - have;
+		unsigned int want = sizeof(buf) - have;
+		if(left < want)
+			want = (unsigned int)left;
+		int rd = want ? f.readData(buf + have, want) : 0;
+		if(rd <= 0)
+			eof = true;
+		else
+			have += rd;
+		unsigned int done = have; // decided up to here
+		if(split >= 0 && split - 1 < pos + have) {
+			const char* p = buf + (split - 1 > pos ? split - 1 - pos : 0);
+			while((p = (const char*)::memmem(p, buf + have - p, mark, mlen))) {
+				unsigned int h = p - buf;
+				if(! eof && have - h < mlen + keep) { // line cut, check it after next read
+					done = h;
+					break;
+				}
+				TelEngine::String line(p + 1, have - h - 1 < keep ? have - h - 1 : keep);
+				if(line.matches(re7)) {
+					if(! found)
+						found = 0 != ::memmem(buf, h + 1, needle->c_str(), needle->length());
+					return pos + h + 1;
+				}
+				++p;
+			}
+		}
+		if(! found) {
+			found = 0 != ::memmem(buf, done, needle->c_str(), needle->length());
+			if(found && split < 0)
+				return end;
+		}
+		unsigned int next = have > carry ? have - carry : 0;
+		if(next > done)
+			next = done;
+		::memmove(buf, buf + next, have - next);
+		have -= next;
+		pos += next;
+	}
+	return end;
+}
+
+}; // anonymous namespace
+
+GrepPool::GrepPool(unsigned int threads, int64_t regionSize)
+	: m_threads(threads ? threads : 1)
+	, m_regionSize(regionSize)
+	, m_params("QueryParams")
+	, m_noNetwork(false)
+	, m_backlog(300)
+	, m_cap(0)
+	, m_format(Writer::PLAIN)
+	, m_context(0)
+	, m_memory(0)
+	, m_deques(NULL)
+	, m_mutex(false, "GrepPool")
+	, m_finished(1, "GrepPool::finished", 0)
+	, m_running(0)
+	, m_skipped(0)
+	, m_pruned(0)
+	, m_needed(0)
+	, m_pending(0)
+	, m_more(1, "GrepPool::more", 0)
+{
+}
+
+GrepPool::~GrepPool()
+{
+	delete[] m_deques;
+}
+
+bool GrepPool::add(const char* name)
+{
+	TelEngine::File f;
+	if(! f.openPath(name)) {
+		fprintf(stderr, "Can not open %s\n", name);
+		return false;
+	}
+	int64_t len = f.length();
+	unsigned int mtime = 0;
+	TelEngine::String path(name);
+	if(m_indexDir) { // one index per file however it is named
+		char* real = ::realpath(name, NULL);
+		if(real)
+			path = real;
+		::free(real);
+		TelEngine::File::getFileTime(path, mtime);
+		if(loadIndex(path, len, mtime))
+			return true;
+	}
+	FileTask* t = new FileTask(path, 0, len); // a worker cuts it while scanning
+	t->m_size = len;
+	t->m_mtime = mtime;
+	if(len > m_regionSize) {
+		t->m_split = true;
+		++m_pending;
+	}
+	m_tasks.append(t);
+	return true;
+}
+
+/* End of a region found: the rest of the file is queued as a new region
+ * right after it, ahead of everything else as the chain waits on it */
+void GrepPool::cut(FileTask& t, int64_t end)
+{
+	m_mutex.lock();
+	if(end < t.m_end) {
+		FileTask* rest = new FileTask(t.m_path, end, t.m_end);
+		rest->m_size = t.m_size;
+		rest->m_mtime = t.m_mtime;
+		rest->m_split = rest->m_end - rest->m_begin > m_regionSize;
+		if(rest->m_split)
+			++m_pending;
+		TelEngine::ObjList* o = m_tasks.find(&t);
+		if(o->next())
+			o->next()->insert(rest);
+		else
+			o->append(rest);
+		m_queue.append(rest)->setDelete(false);
+		t.m_end = end;
+	}
+	t.m_split = false;
+	--m_pending;
+	m_mutex.unlock();
+	m_more.unlock();
+}
+
+/* Sidecar name: the log's canonical path with '%' and '/' escaped as in URIs */
+TelEngine::String GrepPool::indexPath(const TelEngine::String& path) const
+{
+	TelEngine::String s(m_indexDir);
+	s << "/";
+	for(unsigned int i = 0; i < path.length(); ++i) {
+		char c = path.at(i);
+		if(c == '%')
+			s << "%25";
+		else if(c == '/')
+			s << "%2F";
+		else
+			s << c;
+	}
+	s << ".ygi";
+	return s;
+}
+
+static inline u_int32_t getU32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u_int32_t)p[3] << 24);
+}
+
+static inline int64_t getU64(const unsigned char* p)
+{
+	return (int64_t)(getU32(p) | ((u_int64_t)getU32(p + 4) << 32));
+}
+
+static inline unsigned char* putU64(unsigned char* p, int64_t v)
+{
+	return putU32(putU32(p, (u_int32_t)v), (u_int32_t)((u_int64_t)v >> 32));
+}
+
+static bool readAll(TelEngine::File& f, void* buf, unsigned int len)
+{
+	while(len) {
+		int rd = f.readData(buf, len);
+		if(rd <= 0)
+			return false;
+		buf = (char*)buf + rd;
+		len -= rd;
+	}
+	return true;
+}
+
+/* Index file, little-endian:
+ *  "YGI2", u64 file size, u32 file mtime, u32 region count, u32 path length,
+ *  the canonical path of the file, then per region
+ *  u64 begin, u64 end, u32 log2 of filter bits, filter bytes.
+ * Regions must cover the file exactly, or it is rebuilt */
+bool GrepPool::loadIndex(const TelEngine::String& path, int64_t size, unsigned int mtime)
+{
+	TelEngine::File f;
+	if(! f.openPath(indexPath(path)))
+		return false;
+	unsigned char hdr[24];
+	if(! readAll(f, hdr, sizeof(hdr)) || ::memcmp(hdr, "YGI2", 4) || getU64(hdr + 4) != size || getU32(hdr + 12) != mtime
+		|| getU32(hdr + 20) != path.length())
+		return false;
+	u_int32_t count = getU32(hdr + 16);
+	TelEngine::DataBlock name(NULL, path.length());
+	if(! readAll(f, name.data(), name.length()) || ::memcmp(name.data(), path.c_str(), path.length()))
+		return false; // another file's index under the same name
+	TelEngine::ObjList regions;
+	TelEngine::ObjList* last = &regions;
+	int64_t pos = 0;
+	for(u_int32_t i = 0; i < count; ++i) {
+		unsigned char rh[20];
+		if(! readAll(f, rh, sizeof(rh)))
+			return false;
+		int64_t begin = getU64(rh);
+		int64_t end = getU64(rh + 8);
+		u_int32_t bits = getU32(rh + 16);
+		if(begin != pos || end < begin || end > size || bits < SegmentFilter::minBits || bits > SegmentFilter::maxBits
+			|| ((u_int64_t)1 << (bits - 3)) > (u_int64_t)f.length())
+			return false;
+		FileTask* t = new FileTask(path, begin, end);
+		last = last->append(t);
+		t->m_filter = new SegmentFilter(bits);
+		t->m_indexed = true;
+		if(! readAll(f, t->m_filter->m_data, t->m_filter->bytes()))
+			return false;
+		pos = end;
+	}
+	if(pos != size || ! count)
+		return false;
+	while(TelEngine::GenObject* t = regions.remove(false))
+		m_tasks.append(t);
+	return true;
+}
+
+/* Written when every region of the file was parsed in full, through a
+ * temporary name so a concurrent search never reads half of it */
+void GrepPool::saveIndex(TelEngine::ObjList* first)
+{
+	FileTask* t = static_cast<FileTask*>(first->get());
+	const TelEngine::String& path = t->m_path;
+	u_int32_t count = 0;
+	for(TelEngine::ObjList* o = first; o; o = o->skipNext()) {
+		t = static_cast<FileTask*>(o->get());
+		if(t->m_path != path)
+			break;
+		if(! t->m_built)
+			return;
+		++count;
+	}
+	t = static_cast<FileTask*>(first->get());
+	TelEngine::String name = indexPath(path);
+	TelEngine::String tmp(name);
+	tmp << ".tmp";
+	TelEngine::File f;
+	if(! TelEngine::File::exists(m_indexDir))
+		TelEngine::File::mkDir(m_indexDir);
+	bool ok = f.openPath(tmp, true, false, true, false, true, true);
+	unsigned char hdr[24];
+	::memcpy(hdr, "YGI2", 4);
+	putU32(putU32(putU32(putU64(hdr + 4, t->m_size), t->m_mtime), count), path.length());
+	ok = ok && f.writeData(hdr, sizeof(hdr)) == sizeof(hdr)
+		&& f.writeData(path.c_str(), path.length()) == (int)path.length();
+	for(TelEngine::ObjList* o = first; ok && count--; o = o->skipNext()) {
+		t = static_cast<FileTask*>(o->get());
+		unsigned char rh[20];
+		putU32(putU64(putU64(rh, t->m_begin), t->m_end), t->m_filter->m_bits);
+		ok = f.writeData(rh, sizeof(rh)) == sizeof(rh)
+			&& f.writeData(t->m_filter->m_data, t->m_filter->bytes()) == (int)t->m_filter->bytes();
+	}
+	f.terminate();
+	if(ok)
+		ok = TelEngine::File::rename(tmp, name);
+	if(! ok) {
+		fprintf(stderr, "Can not write index %s\n", name.c_str());
+		TelEngine::File::remove(tmp);
+	}
+}
+
+void GrepPool::run(TelEngine::Stream& out)
+{
+	Parser::prepare();
+	unsigned int count = m_tasks.count();
+	m_deques = new TaskDeque[m_threads];
+	for(unsigned int i = 0; i < m_threads; ++i)
+		m_deques[i].tasks = new FileTask*[count / m_threads + 1];
+	unsigned int n = 0;
+	for(TelEngine::ObjList* o = m_tasks.skipNull(); o; o = o->skipNext(), ++n) { // neighbours go to different workers
+		TaskDeque& d = m_deques[n % m_threads];
+		d.tasks[d.tail++] = static_cast<FileTask*>(o->get());
+	}
+	m_running = m_threads;
+	unsigned int started = 0;
+	for(unsigned int i = 0; i < m_threads; ++i) {
+		if((new PoolWorker(this, i))->startup())
+			++started;
+		else {
+			m_mutex.lock();
+			--m_running;
+			m_mutex.unlock();
+		}
+	}
+	if(! started) // no threads, do it here
+		work(0);
+	for(TelEngine::ObjList* o = m_tasks.skipNull(); o; ) {
+		FileTask* t = static_cast<FileTask*>(o->get());
+		t->m_out.live(out); // its worker writes the rest
+		for(;;) {
+			m_mutex.lock();
+			bool done = t->m_done;
+			m_mutex.unlock();
+			if(done)
+				break;
+			m_finished.lock(TelEngine::Thread::idleUsec());
+		}
+		m_mutex.lock(); // workers insert regions they cut off
+		o = o->skipNext();
+		m_mutex.unlock();
+	}
+	for(;;) { // workers still hold a pointer to us
+		m_mutex.lock();
+		unsigned int running = m_running;
+		m_mutex.unlock();
+		if(! running)
+			break;
+		m_finished.lock(TelEngine::Thread::idleUsec());
+	}
+	if(! m_indexDir)
+		return;
+	const TelEngine::String* last = NULL;
+	for(TelEngine::ObjList* o = m_tasks.skipNull(); o; o = o->skipNext()) {
+		FileTask* t = static_cast<FileTask*>(o->get());
+		if(last && *last == t->m_path)
+			continue;
+		last = &t->m_path;
+		if(t->m_filter && ! t->m_indexed)
+			saveIndex(o);
+	}
+}
+
+void GrepPool::work(unsigned int worker)
+{
+	FileTask* t;
+	while((t = take(worker))) {
+		process(*t);
+		m_mutex.lock();
+		t->m_done = true;
+		if(t->m_skipped)
+			++m_skipped;
+		if(t->m_skipped && t->m_indexed)
+			++m_pruned;
+		if(t->m_needed > m_needed)
+			m_needed = t->m_needed;
+		m_mutex.unlock();
+		m_finished.unlock();
+	}
+	m_finished.unlock();
+	m_mutex.lock(); // the pool may be gone as soon as this is released
+	if(m_running)
+		--m_running;
+	m_mutex.unlock();
+}
+
+/* Regions cut off by others come first. With nothing to take, wait while
+ * some big file may still be cut */
+FileTask* GrepPool::take(unsigned int worker)
+{
+	for(;;) {
+		m_mutex.lock();
+		FileTask* t = static_cast<FileTask*>(m_queue.remove(false));
+		unsigned int pending = m_pending;
+		m_mutex.unlock();
+		if(t)
+			return t;
+		TaskDeque& own = m_deques[worker];
+		own.mutex.lock();
+		if(own.head < own.tail)
+			t = own.tasks[own.head++];
+		own.mutex.unlock();
+		for(unsigned int i = 1; ! t && i < m_threads; ++i) {
+			TaskDeque& d = m_deques[(worker + i) % m_threads];
+			d.mutex.lock();
+			if(d.head < d.tail)
+				t = d.tasks[--d.tail];
+			d.mutex.unlock();
+		}
+		if(t || ! pending)
+			return t;
+		m_more.lock(TelEngine::Thread::idleUsec());
+	}
+}
+
+void GrepPool::process(FileTask& t)
+{
+	/* every query param must be matched literally, the longest is the rarest */
+	const TelEngine::String* needle = NULL;
+	for(unsigned int i = 0; i < m_params.length(); ++i) {
+		const TelEngine::NamedString* s = m_params.getParam(i);
+		if(! s)
+			continue;
+		if(t.m_indexed && isIndexed(*s) && ! t.m_filter->check(*s)) {
+			t.m_skipped = true;
+			return;
+		}
+		if(! needle || s->length() > needle->length())
+			needle = s;
+	}
+	TelEngine::File f;
+	if(! f.openPath(t.m_path)) {
+		fprintf(stderr, "Can not open %s\n", t.m_path.c_str());
+		if(t.m_split)
+			cut(t, t.m_end);
+		return;
+	}
+	if(needle && (! needle->length() || needle->length() >= 1024))
+		needle = NULL;
+	bool found = true;
+	if(needle || t.m_split) {
+		int64_t end = scanRegion(f, t.m_begin, t.m_end, t.m_split ? t.m_begin + m_regionSize : -1, needle, found);
+		if(t.m_split)
+			cut(t, end);
+	}
+	HashSet values;
+	HashSet* build = (m_indexDir && ! t.m_indexed) ? &values : NULL; // every entry has to be seen then
+	bool skip = ! found;
+	if(skip) {
+		t.m_skipped = true;
+		if(! build)
+			return;
+	}
+	if(f.seek(TelEngine::Stream::SeekBegin, t.m_begin) < 0)
+		return;
+	size_t share = m_memory / m_threads;
+	Spool spool(share);
+	if(share)
+		t.m_out.limit(share);
+	Writer writer(t.m_out);
+	writer.format(m_format);
+	writer.context(m_context);
+	writer.spool(share ? &spool : NULL);
+	Session session(writer, m_backlog);
+	session.grep().spool(share ? &spool : NULL);
+	session.query().params().copyParams(m_params);
+	session.query().noNetwork(m_noNetwork);
+	session.grep().adaptive(m_cap);
+	Parser parser; // only used while building the filter
+	parser.keepText(! skip);
+	FilterTap tap(build, skip ? NULL : &session);
+	char buf[65536];
+	int64_t left = t.m_end - t.m_begin;
+	while(left > 0) {
+		int rd = f.readData(buf, left < (int64_t)sizeof(buf) ? (int)left : (int)sizeof(buf));
+		if(rd <= 0)
+			break;
+		if(build)
+			parser.feed(buf, rd, tap);
+		else
+			session.feed(buf, rd);
+		left -= rd;
+	}
+	if(build) {
+		parser.finish(tap);
+		t.m_filter = new SegmentFilter(SegmentFilter::bitsFor(values.count()));
+		t.m_filter->add(values);
+		t.m_built = ! left;
+	}
+	if(skip)
+		return;
+	session.finish();
+	t.m_needed = session.grep().needed();
+}
+
+class CompressChunk
+{
+public:
+	CompressChunk()
+		: len(0)
+		{ }
+	unsigned int len;
+	char data[0x40000];
+};
+
+namespace {
+
+class CompressThread: public TelEngine::Thread
+{
+public:
+	CompressThread(Compressor* c)
+		: TelEngine::Thread("Compressor")
+		, m_compressor(c)
+		{ }
+	virtual void run()
+		{ m_compressor->run(); }
+private:
+	Compressor* m_compressor;
+};
+
+#ifdef HAVE_ZLIB
+class GzipCompressor: public Compressor
+{
+public:
+	GzipCompressor(TelEngine::Stream& out, int level)
+		: Compressor(out)
+		, m_init(false)
+	{
+		::memset(&m_z, 0, sizeof(m_z));
+		m_init = (Z_OK == ::deflateInit2(&m_z, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)); // +16: gzip header
+	}
+	virtual ~GzipCompressor()
+	{
+		terminate();
+		if(m_init)
+			::deflateEnd(&m_z);
+	}
+	bool ok() const
+		{ return m_init; }
+protected:
+	virtual bool compress(const void* data, unsigned int len, bool last);
+private:
+	z_stream m_z;
+	bool m_init;
+};
+
+bool GzipCompressor::compress(const void* data, unsigned int len, bool last)
+{
+	unsigned char out[0x10000];
+	m_z.next_in = (Bytef*)data;
+	m_z.avail_in = len;
+	int ret;
+	do {
+		m_z.next_out = out;
+		m_z.avail_out = sizeof(out);
+		ret = ::deflate(&m_z, last ? Z_FINISH : Z_NO_FLUSH);
+		if(ret == Z_STREAM_ERROR)
+			return false;
+		int n = sizeof(out) - m_z.avail_out;
+		if(n && m_out.writeData(out, n) != n)
+			return false;
+	} while(m_z.avail_out == 0 || (last && ret != Z_STREAM_END));
+	return true;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor: public Compressor
+{
+public:
+	ZstdCompressor(TelEngine::Stream& out, int level)
+		: Compressor(out)
+		, m_ctx(::ZSTD_createCCtx())
+	{
+		if(m_ctx && level >= 0)
+			::ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, level);
+	}
+	virtual ~ZstdCompressor()
+	{
+		terminate();
+		::ZSTD_freeCCtx(m_ctx);
+	}
+	bool ok() const
+		{ return m_ctx != NULL; }
+protected:
+	virtual bool compress(const void* data, unsigned int len, bool last);
+private:
+	ZSTD_CCtx* m_ctx;
+};
+
+bool ZstdCompressor::compress(const void* data, unsigned int len, bool last)
+{
+	unsigned char out[0x10000];
+	ZSTD_inBuffer in = { data, len, 0 };
+	for(;;) {
+		ZSTD_outBuffer ob = { out, sizeof(out), 0 };
+		size_t left = ::ZSTD_compressStream2(m_ctx, &ob, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+		if(::ZSTD_isError(left))
+			return false;
+		if(ob.pos && m_out.writeData(out, ob.pos) != (int)ob.pos)
+			return false;
+		if(last ? ! left : in.pos == in.size)
+			return true;
+	}
+}
+#endif
+
+}; // anonymous namespace
+
+Compressor* Compressor::create(TelEngine::Stream& out, const TelEngine::String& codec, int level)
+{
+	Compressor* c = NULL;
+#ifdef HAVE_ZLIB
+	if(codec == YSTRING("gzip") || codec == YSTRING("gz")) {
+		GzipCompressor* z = new GzipCompressor(out, level);
+		if(z->ok())
+			c = z;
+		else
+			delete z;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if(codec == YSTRING("zstd") || codec == YSTRING("zst")) {
+		ZstdCompressor* z = new ZstdCompressor(out, level);
+		if(z->ok())
+			c = z;
+		else
+			delete z;
+	}
+#endif
+	if(c)
+		c->start();
+	return c;
+}
+
+Compressor::Compressor(TelEngine::Stream& out)
+	: m_out(out)
+	, m_fill(NULL)
+	, m_head(0)
+	, m_queued(0)
+	, m_mutex(false, "Compressor")
+	, m_ready(1, "Compressor::ready", 0)
+	, m_space(1, "Compressor::space", 0)
+	, m_threaded(false)
+	, m_running(false)
+	, m_last(false)
+	, m_finished(false)
+	, m_ok(true)
+{
+}
+
+Compressor::~Compressor()
+{
+	if(! m_finished)
+		fprintf(stderr, "Compressor destructed without terminate()\n");
+	delete m_fill;
+}
+
+/* Without a thread everything is compressed inline, slower but still correct */
+bool Compressor::start()
+{
+	m_running = m_threaded = true;
+	if(! (new CompressThread(this))->startup())
+		m_running = m_threaded = false;
+	return m_threaded;
+}
+
+int Compressor::writeData(const void* buffer, int length)
+{
+	if(m_finished || length <= 0)
+		return 0;
+	const char* p = (const char*)buffer;
+	unsigned int left = length;
+	while(left) {
+		if(! m_fill)
+			m_fill = new CompressChunk;
+		unsigned int n = sizeof(m_fill->data) - m_fill->len;
+		if(n > left)
+			n = left;
+		::memcpy(m_fill->data + m_fill->len, p, n);
+		m_fill->len += n;
+		p += n;
+		left -= n;
+		if(m_fill->len == sizeof(m_fill->data)) {
+			queue(m_fill);
+			m_fill = NULL;
+		}
+	}
+	return length;
+}
+
+void Compressor::queue(CompressChunk* c)
+{
+	if(! m_threaded) {
+		if(! compress(c->data, c->len, false))
+			m_ok = false;
+		delete c;
+		return;
+	}
+	m_mutex.lock();
+	while(m_queued >= m_depth) { // let the thread catch up
+		m_mutex.unlock();
+		m_space.lock(TelEngine::Thread::idleUsec());
+		m_mutex.lock();
+	}
+	m_ring[(m_head + m_queued++) % m_depth] = c;
+	m_mutex.unlock();
+	m_ready.unlock();
+}
+
+bool Compressor::terminate()
+{
+	if(m_finished)
+		return m_ok;
+	if(m_fill) {
+		queue(m_fill);
+		m_fill = NULL;
+	}
+	if(m_threaded) {
+		m_mutex.lock();
+		m_last = true;
+		m_mutex.unlock();
+		m_ready.unlock();
+		for(;;) {
+			m_mutex.lock();
+			bool running = m_running;
+			m_mutex.unlock();
+			if(! running)
+				break;
+			m_space.lock(TelEngine::Thread::idleUsec());
+		}
+	} else if(! compress(NULL, 0, true))
+		m_ok = false;
+	m_finished = true;
+	return m_ok;
+}
+
+void Compressor::run()
+{
+	bool ok = true;
+	for(;;) {
+		m_mutex.lock();
+		CompressChunk* c = NULL;
+		if(m_queued) {
+			c = m_ring[m_head];
+			m_head = (m_head + 1) % m_depth;
+			--m_queued;
+		}
+		bool last = m_last;
+		m_mutex.unlock();
+		if(c) {
+			m_space.unlock();
+			if(ok)
+				ok = compress(c->data, c->len, false);
+			delete c;
+			continue;
+		}
+		if(last) {
+			if(ok)
+				ok = compress(NULL, 0, true);
+			break;
+		}
+		m_ready.lock(TelEngine::Thread::idleUsec());
+	}
+	m_space.unlock();
+	m_mutex.lock(); // we may be deleted as soon as this is released
+	if(! ok)
+		m_ok = false;
+	m_running = false;
+	m_mutex.unlock();
+}
+
+void HyperLogLog::add(u_int64_t hash)
+{
+	unsigned int idx = (unsigned int)(hash >> (64 - m_bits));
+	u_int64_t w = hash << m_bits;
+	unsigned char rank = 1;
+	while(rank <= 64 - m_bits && ! (w & 0x8000000000000000ULL)) {
+		++rank;
+		w <<= 1;
+	}
+	if(rank > m_reg[idx])
+		m_reg[idx] = rank;
+}
+
+void HyperLogLog::merge(const HyperLogLog& other)
+{
+	for(unsigned int i = 0; i < sizeof(m_reg); ++i)
+		if(other.m_reg[i] > m_reg[i])
+			m_reg[i] = other.m_reg[i];
+}
+
+u_int64_t HyperLogLog::estimate() const
+{
+	const double m = sizeof(m_reg);
+	double sum = 0;
+	unsigned int zeros = 0;
+	for(unsigned int i = 0; i < sizeof(m_reg); ++i) {
+		sum += ::ldexp(1.0, -(int)m_reg[i]);
+		if(! m_reg[i])
+			++zeros;
+	}
+	double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if(e <= 2.5 * m && zeros) // small range correction: count empty registers
+		e = m * ::log(m / zeros);
+	return (u_int64_t)(e + 0.5);
+}
+
+TopCounter::TopCounter(unsigned int k, unsigned int width)
+	: m_sketch(new u_int32_t[m_depth * width])
+	, m_mask(width - 1)
+	, m_top(new TopItem[k ? k : 1])
+	, m_k(k ? k : 1)
+	, m_used(0)
+{
+	::memset(m_sketch, 0, m_depth * width * sizeof(u_int32_t));
+}
+
+TopCounter::~TopCounter()
+{
+	delete[] m_sketch;
+	delete[] m_top;
+}
+
+/* Conservative update: only the smallest counters grow, which keeps
+ * overestimates from hash collisions low */
+void TopCounter::add(const char* key, unsigned int len, u_int64_t hash)
+{
+	u_int32_t h1 = (u_int32_t)hash;
+	u_int32_t h2 = (u_int32_t)(hash >> 32) | 1;
+	u_int32_t* cell[m_depth];
+	u_int32_t est = 0xffffffff;
+	for(unsigned int i = 0; i < m_depth; ++i) {
+		cell[i] = m_sketch + i * (m_mask + 1) + ((h1 + i * h2) & m_mask);
+		if(*cell[i] < est)
+			est = *cell[i];
+	}
+	if(est < 0xffffffff)
+		++est;
+	for(unsigned int i = 0; i < m_depth; ++i)
+		if(*cell[i] < est)
+			*cell[i] = est;
+
+	unsigned int low = 0;
+	for(unsigned int i = 0; i < m_used; ++i) {
+		TopItem& t = m_top[i];
+		if(t.hash == hash && t.key.length() == len && ! ::memcmp(t.key.c_str(), key, len)) {
+			t.count = est;
+			return;
+		}
+		if(t.count < m_top[low].count)
+			low = i;
+	}
+	if(m_used < m_k)
+		low = m_used++;
+	else if(est <= m_top[low].count)
+		return;
+	m_top[low].key.assign(key, len);
+	m_top[low].hash = hash;
+	m_top[low].count = est;
+}
+
+void TopCounter::sort()
+{
+	for(unsigned int i = 1; i < m_used; ++i) {
+		for(unsigned int j = i; j && m_top[j].count > m_top[j - 1].count; --j) {
+			TopItem tmp = m_top[j];
+			m_top[j] = m_top[j - 1];
+			m_top[j - 1] = tmp;
+		}
+	}
+}
+
+Summary::Summary(TelEngine::Stream& strm, unsigned int topK)
+	: m_json(strm)
+	, m_cur(0)
+	, m_closed(0)
+	, m_names(topK)
+	, m_addrs(topK)
+	, m_open(new CallSlot[m_callSlots])
+	, m_seq(0)
+	, m_evicted(0)
+	, m_finished(false)
+{
+	for(unsigned int i = 0; i < 2; ++i) {
+		m_hours[i].start = -2;
+		::memset(m_hours[i].types, 0, sizeof(m_hours[i].types));
+	}
+	::memset(m_types, 0, sizeof(m_types));
+	::memset(m_open, 0, m_callSlots * sizeof(CallSlot));
+	::memset(m_hist, 0, sizeof(m_hist));
+	m_json.raw("{\"hours\":[");
+}
+
+Summary::~Summary()
+{
+	finish();
+	delete[] m_open;
+}
+
+/* Entries without a timestamp belong to the hour of the one before. Late
+ * entries go to the previous hour while it is open, else to the oldest one */
+Summary::Hour& Summary::hour(const Entry& e)
+{
+	Hour& cur = m_hours[m_cur];
+	const TelEngine::String& ts = e[YSTRING("ts")];
+	if(ts.null()) {
+		if(cur.start == -2)
+			cur.start = -1;
+		return cur;
+	}
+	int64_t h = ::strtoll(ts.c_str(), NULL, 10) / 3600 * 3600;
+	if(cur.start < 0)
+		cur.start = h;
+	if(h <= cur.start) {
+		Hour& prev = m_hours[m_cur ^ 1];
+		return (h < cur.start && prev.start != -2) ? prev : cur;
+	}
+	closeHour(m_hours[m_cur ^ 1]);
+	if(h != cur.start + 3600)
+		closeHour(cur);
+	m_cur ^= 1;
+	m_hours[m_cur].start = h;
+	return m_hours[m_cur];
+}
+
+void Summary::closeHour(Hour& h)
+{
+	if(h.start == -2)
+		return;
+	if(m_closed++)
+		m_json.raw(",");
+	m_json.raw("{\"hour\":");
+	if(h.start >= 0) {
+		char buf[32];
+		time_t t = (time_t)h.start;
+		struct tm tm;
+		::gmtime_r(&t, &tm);
+		::strftime(buf, sizeof(buf), "\"%Y-%m-%dT%H:00Z\"", &tm);
+		m_json.raw(buf);
+	} else
+		m_json.raw("null");
+	number("calls", h.calls.estimate());
+	for(unsigned int i = 0; i <= Entry::STARTUP; ++i)
+		number(Entry::typeString((Entry::Type)i), h.types[i]);
+	m_json.raw("}");
+	h.start = -2;
+	::memset(h.types, 0, sizeof(h.types));
+	h.calls.clear();
+}
+
+void Summary::call(const TelEngine::String& billid, bool final)
+{
+	u_int64_t hash = valueHash(billid.c_str(), billid.length());
+	if(! hash)
+		hash = 1;
+	CallSlot* free = NULL;
+	CallSlot* oldest = NULL;
+	for(unsigned int i = 0; i < m_callProbe; ++i) {
+		CallSlot& c = m_open[(hash + i) & (m_callSlots - 1)];
+		if(c.hash == hash) {
+			++c.messages;
+			c.seen = m_seq;
+			if(final)
+				closeCall(c);
+			return;
+		}
+		if(! c.hash) {
+			if(! free)
+				free = &c;
+		} else if(! oldest || m_seq - c.seen > m_seq - oldest->seen)
+			oldest = &c;
+	}
+	if(! free) {
+		closeCall(*oldest);
+		++m_evicted;
+		free = oldest;
+	}
+	free->hash = hash;
+	free->messages = 1;
+	free->seen = m_seq;
+	if(final)
+		closeCall(*free);
+}
+
+void Summary::closeCall(CallSlot& c)
+{
+	unsigned int b = 0;
+	while(b < m_histBuckets - 1 && (c.messages >> (b + 1)))
+		++b;
+	++m_hist[b];
+	::memset(&c, 0, sizeof(c));
+}
+
+void Summary::eat(Entry* entry)
+{
+	++m_seq;
+	Entry::Type t = entry->type();
+	++m_types[t];
+	Hour& h = hour(*entry);
+	++h.types[t];
+	const TelEngine::NamedString* addr = entry->getParam(YSTRING("address"));
+	if(addr && isAddressParam(*addr)) // not "ring" or link names
+		m_addrs.add(addr->c_str(), addr->length(), valueHash(addr->c_str(), addr->length()));
+	const TelEngine::String& text = entry->text();
+	if(t == Entry::MESSAGE && text.startsWith("Sniffed ")) { // not again when it returns
+		int q = text.find('\'');
+		int end = q >= 0 ? text.find('\'', q + 1) : -1;
+		if(end > q)
+			m_names.add(text.c_str() + q + 1, end - q - 1, valueHash(text.c_str() + q + 1, end - q - 1));
+		const TelEngine::String& billid = (*entry)[YSTRING("billid")];
+		if(! billid.null()) {
+			u_int64_t hash = valueHash(billid.c_str(), billid.length());
+			h.calls.add(hash);
+			m_calls.add(hash);
+			call(billid, (*entry)[YSTRING("operation")] == YSTRING("finalize"));
+		}
+	}
+	delete entry;
+}
+
+void Summary::number(const char* name, u_int64_t value, bool first)
+{
+	char buf[32];
+	if(! first)
+		m_json.raw(",");
+	m_json.string(name, ::strlen(name));
+	::snprintf(buf, sizeof(buf), ":%llu", (unsigned long long)value);
+	m_json.raw(buf);
+}
+
+void Summary::top(const char* name, TopCounter& counter)
+{
+	counter.sort();
+	m_json.raw(",");
+	m_json.string(name, ::strlen(name));
+	m_json.raw(":[");
+	for(unsigned int i = 0; i < counter.count(); ++i) {
+		const TopItem& t = counter.item(i);
+		m_json.raw(i ? ",{\"key\":" : "{\"key\":");
+		m_json.string(t.key);
+		number("count", t.count);
+		m_json.raw("}");
+	}
+	m_json.raw("]");
+}
+
+void Summary::finish()
+{
+	if(m_finished)
+		return;
+	m_finished = true;
+	closeHour(m_hours[m_cur ^ 1]);
+	closeHour(m_hours[m_cur]);
+	m_json.raw("],\"entries\":{");
+	for(unsigned int i = 0; i <= Entry::STARTUP; ++i)
+		number(Entry::typeString((Entry::Type)i), m_types[i], ! i);
+	m_json.raw("}");
+	number("calls", m_calls.estimate());
+	top("messages", m_names);
+	top("addresses", m_addrs);
+	u_int32_t open = 0;
+	for(unsigned int i = 0; i < m_callSlots; ++i) {
+		if(m_open[i].hash) {
+			closeCall(m_open[i]);
+			++open;
+		}
+	}
+	number("calls_open", open);
+	number("calls_evicted", m_evicted);
+	m_json.raw(",\"messages_per_call\":[");
+	bool first = true;
+	for(unsigned int b = 0; b < m_histBuckets; ++b) {
+		if(! m_hist[b])
+			continue;
+		m_json.raw(first ? "{" : ",{");
+		first = false;
+		number("min", (u_int64_t)1 << b, true);
+		if(b < m_histBuckets - 1)
+			number("max", ((u_int64_t)2 << b) - 1);
+		number("calls", m_hist[b]);
+		m_json.raw("}");
+	}
+	m_json.raw("]}\n");
+	m_json.flush();
+}
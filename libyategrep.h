@@ -0,0 +1,1009 @@
+#ifndef __LIBYATEGREP_H
+#define __LIBYATEGREP_H
+
+#include <yatephone.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+class Entry: public TelEngine::NamedList // implies String
+{
+public:
+	enum Type { UNKNOWN = 0, MESSAGE, NETWORK, STARTUP };
+public:
+	Entry(Type type, const TelEngine::String& text)
+		: NamedList(text)
+		, m_type(type)
+		, m_mark(false)
+		, m_next(NULL)
+		, m_spillPos(-1)
+		, m_spillLen(0)
+		, m_node(NULL)
+		, m_time(0)
+	{
+	}
+	Entry(const Entry& e) /**< Copy of text and params, unmarked and not linked anywhere */
+		: NamedList(e)
+		, m_type(e.m_type)
+		, m_mark(false)
+		, m_next(NULL)
+		, m_spillPos(-1)
+		, m_spillLen(0)
+		, m_node(e.m_node)
+		, m_time(e.m_time)
+	{
+	}
+	Type type() const
+		{ return m_type; }
+	bool marked() const
+		{ return m_mark; }
+	void mark(bool value = true)
+		{ m_mark = value; }
+	static const char* typeString(Type t)
+	{
+		switch(t) {
+			case UNKNOWN:
+				return "unknown";
+			case MESSAGE:
+				return "message";
+			case NETWORK:
+				return "network";
+			case STARTUP:
+				return "startup";
+			default:
+				return "xxx";
+		}
+	}
+	const TelEngine::String& text() const
+		{ return *this; } /**< Raw log text, NamedList::length() counts params */
+	Entry* next() const
+		{ return m_next; }
+	void next(Entry* e)
+		{ m_next = e; }
+	bool spilled() const
+		{ return m_spillPos >= 0; }
+	int64_t spillPos() const
+		{ return m_spillPos; }
+	unsigned int spillLen() const
+		{ return m_spillLen; }
+	void spilled(int64_t pos, unsigned int len)
+		{ m_spillPos = pos; m_spillLen = len; }
+	const TelEngine::String* node() const /**< Tag of the Yate node this entry was logged by, NULL if not merging */
+		{ return m_node; }
+	void node(const TelEngine::String* tag)
+		{ m_node = tag; }
+	double time() const /**< Merge key, seconds */
+		{ return m_time; }
+	void time(double t)
+		{ m_time = t; }
+private:
+	Type m_type;
+	bool m_mark;
+	Entry* m_next;
+	int64_t m_spillPos; /**< Offset of entry text in spool file, -1 if text is in memory */
+	unsigned int m_spillLen;
+	const TelEngine::String* m_node;
+	double m_time;
+};
+
+class Query
+{
+public:
+	Query()
+		: m_params("QueryParams")
+		, m_newChannels(0)
+		, m_newAddrs(0)
+		, m_noNetwork(false)
+		, m_dumpOnFlush(false)
+	{
+	}
+	TelEngine::NamedList& params()
+		{ return m_params; }
+	const TelEngine::NamedList& params() const
+		{ return m_params; }
+	bool matches(const Entry& e, bool partial = false) const;
+	bool update(const Entry& e, bool reset, TelEngine::ObjList* added = NULL); /**< Updates query with new channels and addresses from log entry, copies of them go to added. @return true if query was really modified */
+	void learn(const Entry& e); /**< Notes local addresses of merged nodes from every entry */
+	static bool hasChannel(const TelEngine::NamedList& params); /**< True if params name a channel, a message without one is only selected by billid */
+	void flush(const TelEngine::String& node); /**< Forgets channels of one merged node (it restarted) */
+	void flush()
+	{
+		if(m_dumpOnFlush) {
+			TelEngine::File err(2);
+			dump(err);
+		}
+		m_channels.clear();
+		m_newChannels = 0;
+		m_addrs.clear();
+		m_newAddrs = 0;
+		m_keys.clear();
+		m_bound.clear();
+		m_links.clear();
+		m_numbers.clear();
+	}
+	void dump(TelEngine::Stream& out)
+	{
+		out.writeData("Query params:\n ");
+		TelEngine::String d;
+		m_params.dump(d, " ", '\'', true);
+		out.writeData(d);
+
+		d = "\nChannels(";
+		d << m_channels.count() << "/" << m_channels.length() << "):\n";
+		for(TelEngine::ObjList* p = m_channels.skipNull(); p; p = p->skipNext()) {
+			d << " " << p->get()->toString();
+		}
+		out.writeData(d);
+		out.writeData("\nAddresses:\n");
+		for(TelEngine::ObjList* p = m_addrs.skipNull(); p; p = p->skipNext()) {
+			out.writeData(" ");
+			out.writeData(p->get()->toString());
+		}
+		out.writeData("\nCall keys:\n");
+		for(TelEngine::ObjList* p = m_keys.skipNull(); p; p = p->skipNext()) {
+			out.writeData(" ");
+			out.writeData(p->get()->toString());
+		}
+		out.writeData("\n");
+	}
+	TelEngine::String stats() const
+	{
+		TelEngine::String s("params: ");
+		s << m_params.count() << " chans: " << m_channels.count() << " addrs: " << m_addrs.count() << " keys: " << m_keys.count();
+		return s;
+	}
+	void noNetwork(bool b) { m_noNetwork = b; }
+	bool noNetwork() const { return m_noNetwork; }
+	void dumpOnFlush(bool b) { m_dumpOnFlush = b; }
+	bool dumpOnFlush() const { return m_dumpOnFlush; }
+private:
+	bool updateNetwork(const Entry& e, bool reset, TelEngine::ObjList* added);
+	bool addKey(const TelEngine::String& key, TelEngine::ObjList* added);
+	bool addNumber(const TelEngine::String& num);
+	bool namesCall(const Entry& e, bool partial = false) const;
+	TelEngine::NamedList m_params;
+	TelEngine::ObjList m_channels;
+	unsigned int m_newChannels;
+	TelEngine::ObjList m_addrs;
+	unsigned int m_newAddrs;
+	TelEngine::ObjList m_nodeAddrs;
+	TelEngine::ObjList m_keys; /**< SIP Call-IDs and branches, Q.931 call references */
+	TelEngine::ObjList m_bound; /**< Addresses and links whose packets are selected by call key only */
+	TelEngine::ObjList m_links; /**< Signalling links of selected channels, Q.931 entries carry these as address */
+	TelEngine::ObjList m_numbers; /**< Called, caller and routed numbers of selected messages, tie packets to the call */
+	bool m_noNetwork;
+	bool m_dumpOnFlush;
+};
+
+/* Receiver of complete log entries, takes ownership of them */
+class EntrySink
+{
+public:
+	virtual ~EntrySink()
+		{ }
+	virtual void eat(Entry* entry) = 0;
+	virtual void finish() /**< No more entries will follow */
+		{ }
+};
+
+class Parser
+{
+	const static size_t m_bufsize = 8192;
+public:
+	Parser(TelEngine::Stream& strm) /**< Pull mode, entries are read with get() */
+		: m_stream(&strm)
+		, m_bufuse(0)
+		, m_pos(0)
+		, m_last(NULL)
+		, m_verbatimCopy(false)
+		, m_multiline(false)
+		, m_q931(false)
+		, m_keepText(true)
+	{
+	}
+	Parser() /**< Push mode, bytes are supplied with feed() */
+		: m_stream(NULL)
+		, m_bufuse(0)
+		, m_pos(0)
+		, m_last(NULL)
+		, m_verbatimCopy(false)
+		, m_multiline(false)
+		, m_q931(false)
+		, m_keepText(true)
+	{
+	}
+	~Parser()
+		{ delete m_last; }
+	Entry* get();
+	void feed(const char* data, size_t len, EntrySink& sink);
+	Entry* pushLine(const TelEngine::String& s); /**< @return previous entry if this line starts a new one */
+	Entry* finish(); /**< @return pending last entry, if any */
+	void finish(EntrySink& sink); /**< Push mode end of input: parse a last line without newline, pass on pending entries */
+	void keepText(bool keep) /**< Entries get only their first line as text when false */
+		{ m_keepText = keep; }
+	static void prepare(); /**< Compile shared regular expressions before parsing on several threads */
+	int64_t pos() const /**< Bytes consumed so far */
+		{ return m_pos; }
+protected:
+	TelEngine::String getLine();
+	Entry* parseLine(TelEngine::String s);
+	void netLine(Entry& e, TelEngine::String& s);
+	inline Entry* setLast(Entry* e)
+		{ Entry* tmp = m_last; m_last = e; return tmp; }
+	inline void addText(const TelEngine::String& s)
+		{ if(m_keepText) m_last->append(s); }
+private:
+	TelEngine::Stream* m_stream;
+	char m_buf[m_bufsize];
+	size_t m_bufuse;
+	TelEngine::String m_partial;
+	int64_t m_pos;
+	Entry* m_last;
+	bool m_verbatimCopy;
+	bool m_multiline;
+	bool m_q931; /**< Last network entry is Q.931 signalling, not SIP */
+	bool m_keepText;
+	TelEngine::String m_multiKey;
+	TelEngine::String m_multiValue;
+};
+
+/* Memory budget for entry text shared by backlogs, with a temporary file to spill to */
+class Spool
+{
+	const static unsigned int m_segBits = 20; /**< Spool file is reused in segments of 1 MB */
+public:
+	Spool(size_t limit = 0)
+		: m_limit(limit)
+		, m_resident(0)
+		, m_end(0)
+		, m_live(0)
+		, m_segLive(NULL)
+		, m_free(NULL)
+		, m_segs(0)
+		, m_segAlloc(0)
+		, m_freeCount(0)
+		, m_cur(0)
+		{ }
+	~Spool()
+	{
+		::free(m_segLive);
+		::free(m_free);
+	}
+	void limit(size_t bytes)
+		{ m_limit = bytes; }
+	inline void charge(size_t bytes)
+		{ m_resident += bytes; }
+	inline void discharge(size_t bytes)
+		{ m_resident -= bytes; }
+	inline bool over() const
+		{ return m_resident > m_limit; }
+	bool spill(Entry& e); /**< Move entry text to spool file. @return false on I/O error */
+	bool restore(Entry& e); /**< Load entry text back from spool file */
+	void release(Entry& e); /**< Forget spilled text of an entry about to be deleted */
+	TelEngine::String stats() const
+	{
+		TelEngine::String s("resident: ");
+		s << (unsigned int)(m_resident >> 10) << "k spilled: " << m_live;
+		return s;
+	}
+private:
+	bool open();
+	int64_t place(unsigned int len); /**< Where to write len bytes. @return -1 if out of memory */
+	void unuse(int64_t pos, unsigned int len);
+	size_t m_limit;
+	size_t m_resident;
+	TelEngine::File m_file;
+	int64_t m_end; /**< Next free byte of the current segment */
+	unsigned int m_live;
+	unsigned int* m_segLive; /**< Entries stored in each segment */
+	unsigned int* m_free; /**< Segments nothing lives in, except the current one */
+	unsigned int m_segs;
+	unsigned int m_segAlloc;
+	unsigned int m_freeCount;
+	unsigned int m_cur; /**< Segment being filled */
+};
+
+class LogBuf
+{
+public:
+	LogBuf(size_t size)
+		: m_size(size)
+		, m_head(NULL)
+		, m_tail(NULL)
+		, m_count(0)
+		, m_spool(NULL)
+		, m_resident(NULL)
+		{ }
+	~LogBuf()
+	{
+		if(m_head || m_tail || m_count)
+			fprintf(stderr, "EntryBuf destructed with %u entries\n", m_count);
+	}
+	inline void push(Entry* e)
+	{
+		if(m_tail) {
+			m_tail->next(e);
+			++m_count;
+		} else {
+			m_head = m_tail = e;
+			m_count = 1;
+		}
+		m_tail = e;
+		if(m_spool && ! e->spilled()) {
+			m_spool->charge(e->text().length());
+			if(! m_resident)
+				m_resident = e;
+			if(m_spool->over())
+				spill();
+		}
+	}
+	inline Entry* pop()
+	{
+		if(! m_head)
+			return NULL;
+		Entry* e = m_head;
+		if(!(m_head = e->next()))
+			m_tail = NULL;
+		--m_count;
+		if(m_spool) {
+			if(e == m_resident)
+				m_resident = e->next();
+			m_spool->discharge(e->text().length());
+		}
+		e->next(NULL);
+		return e;
+	}
+	inline Entry* pushpop(Entry* ne)
+	{
+		if(! ne)
+			return pop();
+		push(ne);
+		return (m_count <= m_size) ? NULL : pop();
+	}
+	inline Entry* head()
+		{ return m_head; }
+	inline size_t size() const
+		{ return m_size; }
+	inline void size(size_t s)
+		{ m_size = s; }
+	inline size_t count() const
+		{ return m_count; }
+	inline size_t avail() const
+		{ return m_size > count() ? m_size - count() : 0; }
+	Entry* at(size_t index)
+	{
+		Entry* r = m_head;
+		while(r && index) {
+			r = r->next();
+			--index;
+		}
+		return r;
+	}
+	inline bool empty() const
+		{ return ! m_head; }
+	inline void spool(Spool* s)
+		{ m_spool = s; m_resident = s ? m_head : NULL; }
+private:
+	void spill()
+	{
+		/* oldest entries go first; everything before m_resident is already spilled */
+		while(m_resident && m_spool->over()) {
+			if(! m_resident->spilled() && ! m_spool->spill(*m_resident))
+				break;
+			m_resident = m_resident->next();
+		}
+	}
+	size_t m_size;
+	Entry* m_head;
+	Entry* m_tail;
+	size_t m_count;
+	Spool* m_spool;
+	Entry* m_resident; /**< Oldest entry which may still have its text in memory */
+};
+
+
+class HtmlFilter:public TelEngine::Stream
+{
+public:
+	HtmlFilter(TelEngine::Stream& pipe, bool killNewline = false)
+		: unfiltered(pipe)
+		, m_killNewline(killNewline)
+		{ }
+	virtual bool terminate()
+		{ return unfiltered.terminate(); }
+	virtual bool valid() const
+		{ return unfiltered.valid(); }
+	virtual int writeData(const void* buffer, int length)
+	{
+		const char* buf = (const char*)buffer;
+		while((buf[length - 1] == '\n' || buf[length - 1] == '\r') && m_killNewline)
+			--length;
+		int ret = 0;
+		while(length) {
+			const char* p = buf;
+			do {
+				switch(*p) {
+					case '<':
+					case '>':
+					case '&':
+					case '"':
+						break;
+					default:
+						++p;
+						if(--length)
+							continue;
+						break;
+				}
+			} while(0);
+			ret += unfiltered.writeData(buf, p - buf);
+			buf = p;
+
+			if(! length)
+				break;
+			switch(*buf) {
+				case '<':
+					ret += unfiltered.writeData("&lt;");
+					break;
+				case '>':
+					ret += unfiltered.writeData("&gt;");
+					break;
+				case '&':
+					ret += unfiltered.writeData("&amp;");
+					break;
+				case '"':
+					ret += unfiltered.writeData("&quot;");
+					break;
+				default:
+					continue;
+			}
+			++buf;
+			--length;
+		}
+		return ret;
+	}
+	virtual int readData (void* buffer, int length)
+		{ return unfiltered.readData(buffer, length); }
+	using TelEngine::Stream::writeData;
+	TelEngine::Stream& unfiltered;
+private:
+	bool m_killNewline;
+};
+
+class JsonOut
+{
+	const static size_t m_bufsize = 8192;
+public:
+	JsonOut(TelEngine::Stream& strm)
+		: m_strm(strm)
+		, m_bufuse(0)
+		{ }
+	~JsonOut()
+		{ flush(); }
+	void raw(const char* s, size_t len);
+	void raw(const char* s)
+		{ raw(s, strlen(s)); }
+	void string(const char* s, size_t len); /**< Quoted and escaped JSON string */
+	void string(const TelEngine::String& s)
+		{ string(s.c_str(), s.length()); }
+	void flush()
+	{
+		if(m_bufuse)
+			m_strm.writeData(m_buf, m_bufuse);
+		m_bufuse = 0;
+	}
+private:
+	TelEngine::Stream& m_strm;
+	char m_buf[m_bufsize];
+	size_t m_bufuse;
+};
+
+class Writer: public EntrySink
+{
+public:
+	enum Format { PLAIN = 0, XHTML, JSON, BINARY };
+public:
+	Writer(TelEngine::Stream& strm)
+		: m_strm(&strm)
+		, m_format(PLAIN)
+		, m_context(0)
+		, m_showflag(false)
+		, m_tailcount(0)
+		, m_skipcount(0)
+		, m_buf(NULL)
+		, m_spool(NULL)
+		, m_binbuf(NULL)
+		, m_binsize(0)
+		{ }
+	~Writer()
+	{
+		finish();
+		delete m_buf;
+		::free(m_binbuf);
+	}
+	virtual void eat(Entry* entry);
+	virtual void finish();
+	void format(Format f)
+		{ m_format = f; }
+	Format format() const
+		{ return m_format; }
+	void stream(TelEngine::Stream& strm) /**< Write to another stream from now on */
+		{ m_strm = &strm; }
+	void context(unsigned int lines)
+	{
+		delete m_buf;
+		m_context = lines;
+		m_buf = lines ? new LogBuf(lines) : NULL;
+		if(m_buf)
+			m_buf->spool(m_spool);
+	}
+	void spool(Spool* s)
+	{
+		m_spool = s;
+		if(m_buf)
+			m_buf->spool(s);
+	}
+protected:
+	void emit(Entry* entry);
+	void output(const Entry& e);
+	void outputJson(const Entry& e);
+	void outputBinary(const Entry& e);
+	void outputSeparator();
+private:
+	TelEngine::Stream* m_strm;
+	Format m_format;
+	unsigned int m_context;
+	bool m_showflag;
+	unsigned int m_tailcount;
+	unsigned int m_skipcount;
+	LogBuf* m_buf;
+	Spool* m_spool;
+	unsigned char* m_binbuf;
+	size_t m_binsize;
+};
+
+/* Channel ids of entries that left the backlog unmarked, one per slot.
+ * Lets Grep notice correlations that ran off the buffer edge */
+struct Ghost
+{
+	u_int32_t hash;
+	u_int64_t seq; /**< Number of the entry it was seen in, 0 for empty slot */
+};
+
+class Grep
+{
+public:
+	Grep(size_t backlog)
+		: m_buf(backlog)
+		, m_markedCount(0)
+		, m_lastMarked(NULL)
+		, m_base(backlog)
+		, m_cap(0)
+		, m_needed(0)
+		, m_seq(0)
+		, m_lastMiss(0)
+		, m_ghosts(NULL)
+		, m_ghostMask(0)
+		{ }
+	~Grep()
+		{ delete[] m_ghosts; }
+	void push(Entry* e, Query& query, EntrySink& sink); /**< Takes ownership of e, passes it on to sink when it leaves the backlog */
+	void flushBuffer(EntrySink& sink);
+	void backlog(size_t size)
+		{ m_buf.size(size); m_base = size; }
+	size_t backlog() const /**< Current size, may differ from what was set if adaptive */
+		{ return m_buf.size(); }
+	void adaptive(size_t cap) /**< Let backlog grow up to cap entries on missed correlations, 0 to keep it fixed */
+		{ m_cap = cap; }
+	size_t needed() const /**< Largest backlog a missed correlation asked for, 0 if none */
+		{ return m_needed; }
+	void spool(Spool* s)
+		{ m_buf.spool(s); }
+	TelEngine::String stats() const
+	{
+		TelEngine::String s("marked: ");
+		s << m_markedCount;
+		if(m_cap)
+			s << " backlog: " << (unsigned int)m_buf.size();
+		return s;
+	}
+private:
+	size_t horizon() const /**< How old a ghost may be and still count */
+		{ return 4 * (m_cap > m_base ? m_cap : m_base); }
+	void ghost(const Entry& e, u_int64_t seq);
+	void missed(const TelEngine::ObjList& keys);
+	LogBuf m_buf;
+	u_int32_t m_markedCount;
+	const Entry* m_lastMarked; /**< Last marked MESSAGE still in backlog */
+	size_t m_base; /**< Backlog size asked for */
+	size_t m_cap;
+	size_t m_needed;
+	u_int64_t m_seq; /**< Entries pushed so far */
+	u_int64_t m_lastMiss; /**< Entry number of last growth or shrink */
+	Ghost* m_ghosts;
+	u_int32_t m_ghostMask;
+};
+
+/* Push-style front end: feed raw log bytes or parsed entries, selected ones go to the sink */
+class Session: private EntrySink
+{
+public:
+	Session(EntrySink& sink, size_t backlog = 300)
+		: m_sink(sink)
+		, m_grep(backlog)
+		{ }
+	Query& query()
+		{ return m_query; }
+	const Query& query() const
+		{ return m_query; }
+	Grep& grep()
+		{ return m_grep; }
+	const Grep& grep() const
+		{ return m_grep; }
+	const Parser& parser() const
+		{ return m_parser; }
+	void feed(const void* data, size_t len)
+		{ m_parser.feed((const char*)data, len, *this); }
+	void feed(Entry* e)
+		{ m_grep.push(e, m_query, m_sink); }
+	void finish()
+	{
+		m_parser.finish(*this);
+		m_grep.flushBuffer(m_sink);
+		m_sink.finish();
+	}
+private:
+	virtual void eat(Entry* entry)
+		{ feed(entry); }
+	EntrySink& m_sink;
+	Parser m_parser;
+	Query m_query;
+	Grep m_grep;
+};
+
+/* One watched call: its own Session writing to its own file */
+class CallFile: public TelEngine::GenObject
+{
+public:
+	CallFile(const TelEngine::String& billid, size_t backlog)
+		: m_billid(billid)
+		, m_writer(m_file)
+		, m_session(m_writer, backlog)
+		{ m_session.query().params().setParam("billid", billid); }
+	~CallFile()
+		{ m_session.finish(); }
+	virtual const TelEngine::String& toString() const
+		{ return m_billid; }
+	bool open(const char* path)
+		{ return m_file.openPath(path, true, false, true, true, true, true, false); }
+	Session& session()
+		{ return m_session; }
+	Writer& writer()
+		{ return m_writer; }
+	bool cdr(const TelEngine::String& chan, bool final) /**< Notes a call.cdr of one channel. @return true when no channel's CDR is left open */
+	{
+		TelEngine::ObjList* o = m_cdrs.find(chan);
+		if(! final) {
+			if(! o)
+				m_cdrs.append(new TelEngine::String(chan));
+			return false;
+		}
+		if(o)
+			o->remove();
+		return ! m_cdrs.skipNull();
+	}
+private:
+	TelEngine::String m_billid;
+	TelEngine::File m_file;
+	Writer m_writer;
+	Session m_session;
+	TelEngine::ObjList m_cdrs; /**< Channels whose CDR was not finalized yet */
+};
+
+/* Routes entries to one CallFile per watched billid, closes a call once the
+ * CDRs of all its channels are finalized. An entry with a billid only goes
+ * to that call, others go to every call */
+class Splitter: public EntrySink
+{
+public:
+	Splitter(const char* dir, size_t backlog = 300)
+		: m_dir(dir)
+		, m_backlog(backlog)
+		, m_format(Writer::PLAIN)
+		{ }
+	~Splitter()
+		{ finish(); }
+	CallFile* watch(const TelEngine::String& billid); /**< Start extracting a call into <dir>/<billid>.log */
+	bool unwatch(const TelEngine::String& billid);
+	unsigned int count() const
+		{ return m_calls.count(); }
+	const TelEngine::ObjList& calls() const
+		{ return m_calls; }
+	void format(Writer::Format f)
+		{ m_format = f; }
+	virtual void eat(Entry* entry);
+	virtual void finish()
+		{ m_calls.clear(); }
+private:
+	TelEngine::String m_dir;
+	size_t m_backlog;
+	Writer::Format m_format;
+	TelEngine::ObjList m_calls;
+};
+
+/* One node's log, parsed ahead on its own thread */
+class NodeInput: public TelEngine::RefObject
+{
+public:
+	NodeInput(const char* tag, const char* path, size_t readahead);
+	~NodeInput();
+	virtual const TelEngine::String& toString() const
+		{ return m_tag; }
+	bool start(); /**< Open file and start the reader thread */
+	void stop()
+		{ m_stop = true; }
+	Entry* get(); /**< Next entry in file order, blocks until one is available. @return NULL at end of file */
+	void read(); /**< Reader thread body */
+private:
+	void put(LogBuf& batch);
+	TelEngine::String m_tag;
+	TelEngine::String m_path;
+	TelEngine::File m_file;
+	size_t m_readahead;
+	TelEngine::Mutex m_mutex;
+	TelEngine::Semaphore m_ready; /**< Reader queued something */
+	TelEngine::Semaphore m_space; /**< Consumer took something */
+	LogBuf m_queue; /**< Shared with the reader, guarded by m_mutex */
+	LogBuf m_local; /**< Consumer side only */
+	bool m_eof;
+	volatile bool m_stop;
+};
+
+/* Timestamp-ordered k-way merge of several nodes' logs into one Session */
+class Merger
+{
+public:
+	Merger(size_t readahead = 1024)
+		: m_readahead(readahead)
+		{ }
+	~Merger();
+	bool add(const char* tag, const char* path);
+	unsigned int count() const
+		{ return m_inputs.count(); }
+	void run(Session& session);
+private:
+	TelEngine::ObjList m_inputs;
+	size_t m_readahead;
+};
+
+/* Collects output in memory */
+class MemStream: public TelEngine::Stream
+{
+public:
+	MemStream()
+		: m_data(0x10000)
+		{ }
+	virtual bool terminate()
+		{ return true; }
+	virtual bool valid() const
+		{ return true; }
+	virtual int writeData(const void* buffer, int length)
+	{
+		if(length > 0)
+			m_data.append(const_cast<void*>(buffer), length);
+		return length;
+	}
+	virtual int readData(void* buffer, int length)
+		{ return 0; }
+	using TelEngine::Stream::writeData;
+	const TelEngine::DataBlock& data() const
+		{ return m_data; }
+	void clear()
+		{ m_data.clear(); }
+private:
+	TelEngine::DataBlock m_data;
+};
+
+class CompressChunk;
+
+/* Compresses everything written to it on a thread of its own and writes the
+ * result to another stream. Subclasses implement one codec and must call
+ * terminate() in their destructor */
+class Compressor: public TelEngine::Stream
+{
+public:
+	static Compressor* create(TelEngine::Stream& out, const TelEngine::String& codec, int level = -1); /**< "gzip" or "gz" if built with HAVE_ZLIB, "zstd" or "zst" if built with HAVE_ZSTD. @return NULL if unknown */
+	virtual ~Compressor();
+	virtual bool terminate(); /**< Compress what is left, end the compressed stream and wait for the thread */
+	virtual bool valid() const
+		{ return m_ok && m_out.valid(); }
+	virtual int writeData(const void* buffer, int length);
+	virtual int readData(void* buffer, int length)
+		{ return 0; }
+	using TelEngine::Stream::writeData;
+	void run(); /**< Compressor thread body */
+protected:
+	Compressor(TelEngine::Stream& out);
+	bool start();
+	virtual bool compress(const void* data, unsigned int len, bool last) = 0; /**< Runs on compressor thread, writes to m_out */
+	TelEngine::Stream& m_out;
+private:
+	void queue(CompressChunk* c);
+	const static unsigned int m_depth = 4; /**< Chunks waiting for the thread */
+	CompressChunk* m_fill;
+	CompressChunk* m_ring[m_depth];
+	unsigned int m_head;
+	unsigned int m_queued;
+	TelEngine::Mutex m_mutex;
+	TelEngine::Semaphore m_ready;
+	TelEngine::Semaphore m_space;
+	bool m_threaded;
+	bool m_running;
+	bool m_last;
+	bool m_finished;
+	bool m_ok;
+};
+
+class FileTask;
+struct TaskDeque;
+
+/* Independent log files, and big ones cut at Yate startups, grepped on a
+ * work-stealing thread pool. Output comes out in input order. With an index
+ * directory each file gets a sidecar of per-region Bloom filters, regions
+ * that can not hold the query are skipped unread on later searches */
+class GrepPool
+{
+public:
+	GrepPool(unsigned int threads, int64_t regionSize = (int64_t)64 << 20);
+	~GrepPool();
+	TelEngine::NamedList& params() /**< Query every file is searched with */
+		{ return m_params; }
+	void noNetwork(bool b)
+		{ m_noNetwork = b; }
+	void backlog(size_t size, size_t cap = 0)
+		{ m_backlog = size; m_cap = cap; }
+	void format(Writer::Format f)
+		{ m_format = f; }
+	void context(unsigned int lines)
+		{ m_context = lines; }
+	void memory(size_t bytes) /**< Split among threads: each part's log text and output kept in memory, the rest is spooled */
+		{ m_memory = bytes; }
+	void index(const char* dir) /**< Keep region filters of searched files in dir */
+		{ m_indexDir = dir; }
+	bool add(const char* path); /**< Queue a file, cut into regions as its valid index says or later while searching */
+	void run(TelEngine::Stream& out);
+	size_t needed() const /**< Largest backlog any region asked for, see Grep::needed() */
+		{ return m_needed; }
+	TelEngine::String stats() const
+	{
+		TelEngine::String s("regions: ");
+		s << m_tasks.count() << " skipped: " << m_skipped;
+		if(m_indexDir)
+			s << " by index: " << m_pruned;
+		return s;
+	}
+	void work(unsigned int worker); /**< Worker thread body */
+private:
+	FileTask* take(unsigned int worker);
+	void process(FileTask& t);
+	void cut(FileTask& t, int64_t end);
+	TelEngine::String indexPath(const TelEngine::String& path) const;
+	bool loadIndex(const TelEngine::String& path, int64_t size, unsigned int mtime);
+	void saveIndex(TelEngine::ObjList* first);
+	unsigned int m_threads;
+	int64_t m_regionSize;
+	TelEngine::NamedList m_params;
+	bool m_noNetwork;
+	size_t m_backlog;
+	size_t m_cap;
+	Writer::Format m_format;
+	unsigned int m_context;
+	size_t m_memory;
+	TelEngine::String m_indexDir;
+	TelEngine::ObjList m_tasks;
+	TaskDeque* m_deques;
+	TelEngine::Mutex m_mutex; /**< Guards task completion and counters below */
+	TelEngine::Semaphore m_finished;
+	unsigned int m_running;
+	unsigned int m_skipped;
+	unsigned int m_pruned; /**< Skipped by index */
+	size_t m_needed;
+	unsigned int m_pending; /**< Tasks that may still be cut, guarded by m_mutex */
+	TelEngine::ObjList m_queue; /**< Regions cut off, not taken yet */
+	TelEngine::Semaphore m_more;
+};
+
+/* Distinct count estimate in fixed memory, about 1.6% standard error */
+class HyperLogLog
+{
+	const static unsigned int m_bits = 12;
+public:
+	HyperLogLog()
+		{ clear(); }
+	void clear()
+		{ ::memset(m_reg, 0, sizeof(m_reg)); }
+	void add(u_int64_t hash);
+	void merge(const HyperLogLog& other);
+	u_int64_t estimate() const;
+private:
+	unsigned char m_reg[1 << m_bits];
+};
+
+struct TopItem
+{
+	TelEngine::String key;
+	u_int64_t hash;
+	u_int32_t count;
+};
+
+/* Count-min sketch of key frequencies, keeping the k heaviest keys by name */
+class TopCounter
+{
+	const static unsigned int m_depth = 4;
+public:
+	TopCounter(unsigned int k = 20, unsigned int width = 4096); /**< width must be a power of 2 */
+	~TopCounter();
+	void add(const char* key, unsigned int len, u_int64_t hash);
+	unsigned int count() const
+		{ return m_used; }
+	const TopItem& item(unsigned int i) const /**< Heaviest first after sort() */
+		{ return m_top[i]; }
+	void sort();
+private:
+	u_int32_t* m_sketch;
+	u_int32_t m_mask;
+	TopItem* m_top;
+	unsigned int m_k;
+	unsigned int m_used;
+};
+
+/* Message count of calls still going, bounded: the longest idle call is
+ * closed early if its slots are all taken */
+struct CallSlot
+{
+	u_int64_t hash; /**< 0 for free slot */
+	u_int32_t messages;
+	u_int32_t seen; /**< Entry number of last message, truncated */
+};
+
+/* Aggregate statistics of a log in one pass and fixed memory, written as one JSON object.
+ * Entries are deleted as soon as they are counted, their text is never kept */
+class Summary: public EntrySink
+{
+	const static unsigned int m_histBuckets = 20; /**< Powers of 2 of messages per call */
+	const static unsigned int m_callSlots = 65536;
+	const static unsigned int m_callProbe = 8;
+public:
+	Summary(TelEngine::Stream& strm, unsigned int topK = 20);
+	~Summary();
+	virtual void eat(Entry* entry);
+	virtual void finish(); /**< Write the report */
+private:
+	struct Hour
+	{
+		int64_t start; /**< Seconds, -1 for entries without timestamp, -2 for unused */
+		u_int32_t types[Entry::STARTUP + 1];
+		HyperLogLog calls;
+	};
+	Hour& hour(const Entry& e);
+	void closeHour(Hour& h);
+	void call(const TelEngine::String& billid, bool final);
+	void closeCall(CallSlot& c);
+	void number(const char* name, u_int64_t value, bool first = false);
+	void top(const char* name, TopCounter& counter);
+	JsonOut m_json;
+	Hour m_hours[2]; /**< Previous and current hour, entries straddling the boundary land right */
+	unsigned int m_cur;
+	unsigned int m_closed;
+	u_int64_t m_types[Entry::STARTUP + 1];
+	HyperLogLog m_calls;
+	TopCounter m_names;
+	TopCounter m_addrs;
+	CallSlot* m_open;
+	u_int32_t m_seq;
+	u_int64_t m_hist[m_histBuckets];
+	u_int32_t m_evicted;
+	bool m_finished;
+};
+
+#endif /* __LIBYATEGREP_H */
@@ -0,0 +1,284 @@
+#include "libyategrep.h"
+
+/* In-process call extraction: sees every dispatched message, writes the ones
+ * correlated with watched billids to per-call files without going through
+ * a full msgsniff log. Network dumps are debug output, not messages, so they
+ * can not be seen from here. Dispatchers only filter and queue messages,
+ * grepping and writing is done on a thread of our own. */
+
+using namespace TelEngine;
+namespace { // anonymous
+
+class DispatchHook: public MessagePostHook
+{
+public:
+	virtual void dispatched(const Message& msg, bool handled);
+};
+
+class SplitThread: public Thread
+{
+public:
+	SplitThread()
+		: Thread("YGrepSplit")
+		{ }
+	virtual void run();
+};
+
+class YGrepModule: public Module
+{
+public:
+	YGrepModule();
+	virtual ~YGrepModule();
+	virtual void initialize();
+	void dispatched(const Message& msg, bool handled);
+	void split(); /**< Split thread body */
+protected:
+	virtual bool commandExecute(String& retVal, const String& line);
+	virtual void statusParams(String& str);
+private:
+	static Entry* buildEntry(const Message& msg, bool handled);
+	void updateWatched();
+	bool watching(const String& billid) const
+	{
+		unsigned int h = billid.hash() & (s_billidBits - 1);
+		return 0 != (m_billids[h >> 5] & (1u << (h & 31)));
+	}
+	const static unsigned int s_billidBits = 4096;
+	const static unsigned int s_queueMax = 65536;
+	Splitter* m_splitter;
+	DispatchHook* m_hook;
+	volatile unsigned int m_watched; /**< Calls watched, checked without the lock on every dispatch */
+	volatile u_int32_t m_billids[s_billidBits / 32]; /**< Hashes of watched billids, read without the lock */
+	Mutex m_queueMutex; /**< Only guards the queue, never held while grepping */
+	Semaphore m_ready;
+	LogBuf m_queue;
+	unsigned int m_dropped; /**< Entries lost to a full queue */
+	bool m_threaded;
+	bool m_stop;
+	bool m_running;
+};
+
+INIT_PLUGIN(YGrepModule);
+
+void DispatchHook::dispatched(const Message& msg, bool handled)
+{
+	__plugin.dispatched(msg, handled);
+}
+
+void SplitThread::run()
+{
+	__plugin.split();
+}
+
+YGrepModule::YGrepModule()
+	: Module("yategrep", "misc")
+	, m_splitter(NULL)
+	, m_hook(NULL)
+	, m_watched(0)
+	, m_queueMutex(false, "YGrepQueue")
+	, m_ready(1, "YGrepQueue::ready", 0)
+	, m_queue(0)
+	, m_dropped(0)
+	, m_threaded(false)
+	, m_stop(false)
+	, m_running(false)
+{
+	Output("Loaded module yategrep");
+	::memset((void*)m_billids, 0, sizeof(m_billids));
+}
+
+YGrepModule::~YGrepModule()
+{
+	Output("Unloading module yategrep");
+	if(m_hook) {
+		if(Engine::self())
+			Engine::self()->setHook(m_hook, true);
+		TelEngine::destruct(m_hook);
+	}
+	m_queueMutex.lock();
+	m_stop = true;
+	m_queueMutex.unlock();
+	m_ready.unlock();
+	for(;;) { // the thread empties the queue before it goes
+		m_queueMutex.lock();
+		bool running = m_running;
+		m_queueMutex.unlock();
+		if(! running)
+			break;
+		Thread::idle();
+	}
+	Lock lock(this);
+	m_watched = 0;
+	Entry* e;
+	while((e = m_queue.pop()))
+		delete e;
+	delete m_splitter;
+	m_splitter = NULL;
+}
+
+void YGrepModule::initialize()
+{
+	Output("Initializing module yategrep");
+	Configuration cfg(Engine::configFile("yategrep"));
+	cfg.load();
+	Lock lock(this);
+	if(! m_splitter) {
+		setup();
+		m_splitter = new Splitter(cfg.getValue("general", "dir", "/tmp"), cfg.getIntValue("general", "backlog", 300));
+		m_running = m_threaded = true;
+		if(! (new SplitThread)->startup()) {
+			Debug(this, DebugWarn, "Can not start split thread, calls are grepped while dispatching");
+			m_running = m_threaded = false;
+		}
+		m_hook = new DispatchHook;
+		Engine::self()->setHook(m_hook);
+	}
+	String fmt = cfg.getValue("general", "format", "plain");
+	m_splitter->format(fmt == YSTRING("json") ? Writer::JSON : (fmt == YSTRING("html") ? Writer::XHTML : Writer::PLAIN));
+}
+
+/* Same shape as a msgsniff dump so Parser and Writer users see familiar text */
+Entry* YGrepModule::buildEntry(const Message& msg, bool handled)
+{
+	char ts[32];
+	u_int64_t t = msg.msgTime().usec();
+	::snprintf(ts, sizeof(ts), "%u.%06u", (unsigned int)(t / 1000000), (unsigned int)(t % 1000000));
+	String text("Sniffed '");
+	text << msg << "' time=" << ts << "\n  handled=" << handled << "\n  retval='" << msg.retValue() << "'\n";
+	unsigned int n = msg.length();
+	for(unsigned int i = 0; i < n; ++i) {
+		const NamedString* s = msg.getParam(i);
+		if(s)
+			text << "  param['" << s->name() << "'] = '" << *s << "'\n";
+	}
+	Entry* e = new Entry(Entry::MESSAGE, text);
+	e->setParam("ts", ts);
+	for(unsigned int i = 0; i < n; ++i) {
+		const NamedString* s = msg.getParam(i);
+		if(s)
+			e->setParam(s->name(), *s);
+	}
+	return e;
+}
+
+/* Rebuilds the billid filter and count dispatchers look at, under the lock */
+void YGrepModule::updateWatched()
+{
+	u_int32_t bits[s_billidBits / 32];
+	::memset(bits, 0, sizeof(bits));
+	unsigned int n = 0;
+	if(m_splitter) {
+		for(ObjList* o = m_splitter->calls().skipNull(); o; o = o->skipNext(), ++n) {
+			unsigned int h = o->get()->toString().hash() & (s_billidBits - 1);
+			bits[h >> 5] |= 1u << (h & 31);
+		}
+	}
+	for(unsigned int i = 0; i < s_billidBits / 32; ++i) // bits of calls still watched never clear
+		m_billids[i] = bits[i];
+	m_watched = n;
+}
+
+/* Runs on every dispatcher thread: a message of another call, or of no call
+ * and no channel, is dropped before it costs anything */
+void YGrepModule::dispatched(const Message& msg, bool handled)
+{
+	if(! m_watched)
+		return;
+	const String* billid = msg.getParam(YSTRING("billid"));
+	if(billid ? ! watching(*billid) : ! Query::hasChannel(msg))
+		return;
+	Entry* e = buildEntry(msg, handled);
+	if(! m_threaded) {
+		Lock lock(this);
+		if(m_splitter)
+			m_splitter->eat(e);
+		else
+			delete e;
+		updateWatched(); // a final CDR ends watching its call
+		return;
+	}
+	m_queueMutex.lock();
+	bool full = m_queue.count() >= s_queueMax;
+	if(full)
+		++m_dropped;
+	else
+		m_queue.push(e);
+	m_queueMutex.unlock();
+	if(full)
+		delete e; // never make the engine wait for our disk
+	else
+		m_ready.unlock();
+}
+
+void YGrepModule::split()
+{
+	LogBuf batch(0);
+	for(;;) {
+		m_queueMutex.lock();
+		Entry* e;
+		while((e = m_queue.pop()))
+			batch.push(e);
+		bool stop = m_stop;
+		m_queueMutex.unlock();
+		if(batch.empty()) {
+			if(stop)
+				break;
+			m_ready.lock(Thread::idleUsec());
+			continue;
+		}
+		lock();
+		while((e = batch.pop())) {
+			if(m_splitter)
+				m_splitter->eat(e);
+			else
+				delete e;
+		}
+		updateWatched(); // a final CDR ends watching its call
+		unlock();
+	}
+	m_queueMutex.lock(); // the module may be gone as soon as this is released
+	m_running = false;
+	m_queueMutex.unlock();
+}
+
+bool YGrepModule::commandExecute(String& retVal, const String& line)
+{
+	String l(line);
+	if(! l.startSkip(name()))
+		return false;
+	l.trimSpaces();
+	Lock lock(this);
+	if(! m_splitter)
+		return false;
+	if(l.startSkip("watch")) {
+		if(l.null() || ! m_splitter->watch(l))
+			return false;
+		updateWatched();
+		retVal << "Watching call " << l << "\r\n";
+		return true;
+	}
+	if(l.startSkip("unwatch")) {
+		if(! m_splitter->unwatch(l))
+			return false;
+		updateWatched();
+		retVal << "Stopped watching call " << l << "\r\n";
+		return true;
+	}
+	if(l == YSTRING("list")) {
+		for(ObjList* o = m_splitter->calls().skipNull(); o; o = o->skipNext())
+			retVal << o->get()->toString() << "\r\n";
+		return true;
+	}
+	return false;
+}
+
+void YGrepModule::statusParams(String& str)
+{
+	Lock lock(this);
+	str.append("calls=", ",") << (m_splitter ? m_splitter->count() : 0);
+	m_queueMutex.lock();
+	str << ",queued=" << (unsigned int)m_queue.count() << ",dropped=" << m_dropped;
+	m_queueMutex.unlock();
+}
+
+}; // anonymous namespace
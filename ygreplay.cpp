@@ -0,0 +1,80 @@
+#include "libyategrep.h"
+
+/* Replays a log file through Splitter, the same per-call extraction
+ * yategrep.yate does inside a running Yate */
+
+static void help()
+{
+	puts("Usage:\n\tygreplay [opts] inputfilename|- billid [billid ...]");
+	puts("Opts:\n\t-h\tthis help\n\t-d dir\twrite per-call files to dir (default: .)");
+	puts("\t-j\tJSON Lines output\n\t-x\t(X)HTML fragment output");
+	puts("\t-B nnn\tset buffer size to nnn messages (default: 300)");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* dir = ".";
+	size_t backlog = 300;
+	Writer::Format format = Writer::PLAIN;
+
+	/* parse command-line options */
+	++argv; // skip our filename
+	while(--argc) {
+		if(**argv != '-' || ! (*argv)[1])
+			break;
+		switch((*argv)[1]) {
+			case 'h':
+				help();
+				return 0;
+			case 'd':
+				dir = *++argv;
+				--argc;
+				break;
+			case 'j':
+				format = Writer::JSON;
+				break;
+			case 'x':
+				format = Writer::XHTML;
+				break;
+			case 'B':
+				backlog = strtoul(*++argv, NULL, 10);
+				--argc;
+				break;
+			default:
+				fprintf(stderr, "Unknown command-line option '%s'\n", *argv);
+				break;
+		}
+		++argv;
+	}
+	if(argc < 2) {
+		help();
+		return 1;
+	}
+
+	TelEngine::File input;
+	if(0 == strcmp("-", *argv))
+		input.attach(0);
+	else if(! input.openPath(*argv)) {
+		fprintf(stderr, "Can not open %s\n", *argv);
+		return 1;
+	}
+	++argv; --argc;
+
+	Splitter splitter(dir, backlog);
+	splitter.format(format);
+	for(; argc; ++argv, --argc) {
+		if(! splitter.watch(*argv))
+			return 1;
+	}
+
+	Parser parser(input);
+	unsigned int entries = 0;
+	Entry* e;
+	while((e = parser.get())) {
+		splitter.eat(e);
+		++entries;
+	}
+	fprintf(stderr, "Replayed %u entries, %u calls still open\n", entries, splitter.count());
+	splitter.finish();
+	return 0;
+}